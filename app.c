@@ -0,0 +1,260 @@
+/* ******************************************************************
+   Layer 5 application for the emulator (see app.h).
+
+   The source maps its input file and copies each message straight out
+   of the mapping.  The sink does not copy delivered messages: it takes
+   a reference to the pool packet each one lies in and gathers up to
+   SINKBATCH of them into one writev() call.  Both sides keep a running
+   FNV-1a checksum, compared when the run finishes.  The source moves on
+   only past messages the sender accepted, so what it sent is always the
+   start of the file; if the arrivals end before the whole file has been
+   accepted, the prefix that was sent is compared, but the run reports
+   a partial transfer rather than a verified one.
+   ****************************************************************** */
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "emulator.h"
+#include "app.h"
+
+#define  SINKBATCH  256   /* messages gathered into one writev call */
+
+/* source */
+static const char *srcmap = NULL;   /* the mapped input, NULL if none */
+static size_t srclen;
+static size_t srcoff;               /* next byte to send */
+static size_t srcnext;              /* bytes in the message last offered */
+static uint32_t srcsum;             /* checksum of the whole input */
+static int srcopen = 0;
+
+/* sink */
+static int sinkfd = -1;
+static const char *sinkpath;
+static struct iovec iov[SINKBATCH];
+static const struct pkt *held[SINKBATCH];  /* packets the iovecs point into */
+static int niov;
+static size_t sinkbytes;            /* bytes taken by the sink this run */
+static uint32_t sinksum;
+static long nwritev;
+
+static struct timespec started;
+
+static uint32_t fnv1a(uint32_t sum, const char *data, size_t len)
+{
+  size_t i;
+
+  for (i=0; i<len; i++) {
+    sum ^= (unsigned char)data[i];
+    sum *= 16777619u;
+  }
+  return sum;
+}
+
+#define  FNVBASIS  2166136261u
+
+static void fail(const char *what, const char *path)
+{
+  printf("%s %s: %s\n", what, path, strerror(errno));
+  exit(EXIT_FAILURE);
+}
+
+/************************** SOURCE *****************/
+long opensource(const char *path)
+{
+  struct stat st;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) < 0)
+    fail("cannot open", path);
+  srclen = st.st_size;
+  if (srclen > 0) {
+    srcmap = mmap(NULL, srclen, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (srcmap == MAP_FAILED)
+      fail("cannot map", path);
+    posix_madvise((void *)srcmap, srclen, POSIX_MADV_SEQUENTIAL);
+  }
+  close(fd);
+  srcsum = fnv1a(FNVBASIS, srcmap, srclen);
+  srcopen = 1;
+  return (srclen + MSGSIZE - 1) / MSGSIZE;
+}
+
+void nextmessage(struct msg *message)
+{
+  size_t n = 0;
+
+  if (srcoff < srclen) {
+    n = srclen - srcoff < MSGSIZE ? srclen - srcoff : MSGSIZE;
+    memcpy(message->data, srcmap + srcoff, n);
+  }
+  memset(message->data + n, 0, MSGSIZE - n);
+  srcnext = n;
+}
+
+void acceptmessage(void)
+{
+  srcoff += srcnext;
+  srcnext = 0;
+}
+
+int sourceleft(void)
+{
+  return srcoff < srclen;
+}
+
+/************************** SINK *******************/
+void opensink(const char *path)
+{
+  sinkfd = open(path, O_WRONLY | O_CREAT, 0666);
+  if (sinkfd < 0)
+    fail("cannot create", path);
+  sinkpath = path;
+}
+
+/* write out the gathered messages and let go of their packets */
+static void flushsink(void)
+{
+  struct iovec *v = iov;
+  int i, n = niov;
+  ssize_t done;
+
+  while (n > 0) {
+    done = writev(sinkfd, v, n);
+    nwritev++;
+    if (done < 0) {
+      if (errno == EINTR)
+        continue;
+      fail("cannot write", sinkpath);
+    }
+    /* skip what was written; a short write resumes mid-iovec */
+    while (n > 0 && (size_t)done >= v->iov_len) {
+      done -= v->iov_len;
+      v++;
+      n--;
+    }
+    if (n > 0) {
+      v->iov_base = (char *)v->iov_base + done;
+      v->iov_len -= done;
+    }
+  }
+  for (i=0; i<niov; i++)
+    releasepkt(held[i]);
+  niov = 0;
+}
+
+void sinkmessage(const struct pkt *packet, const char *data, int length)
+{
+  struct pkt *copy;
+
+  /* the padding of the source's last message is not part of the file */
+  if (srcopen && sinkbytes + length > srclen)
+    length = sinkbytes < srclen ? srclen - sinkbytes : 0;
+  sinkbytes += length;
+  sinksum = fnv1a(sinksum, data, length);
+  if (sinkfd < 0 || length == 0)
+    return;
+  if (packet == NULL) {           /* not in a pool packet: keep a copy */
+    copy = newpkt();
+    memcpy(copy->payload, data, length);
+    data = copy->payload;
+    packet = copy;
+  }
+  else
+    holdpkt(packet);
+  held[niov] = packet;
+  iov[niov].iov_base = (char *)data;
+  iov[niov].iov_len = length;
+  if (++niov == SINKBATCH)
+    flushsink();
+}
+
+/************************** SNAPSHOTS **************/
+void saveapp(FILE *f)
+{
+  if (sinkfd >= 0)
+    flushsink();
+  saveint(f, srcopen ? (long)srclen : -1);
+  saveint(f, (long)srcsum);
+  saveint(f, (long)srcoff);
+  saveint(f, (long)sinkbytes);
+  saveint(f, (long)sinksum);
+}
+
+void loadapp(FILE *f)
+{
+  struct stat st;
+  long len = loadint(f);
+  uint32_t sum = loadint(f);
+
+  if (len != (srcopen ? (long)srclen : -1) || (srcopen && sum != srcsum)) {
+    printf("the snapshot was taken with a different input file (-i)\n");
+    exit(EXIT_FAILURE);
+  }
+  srcoff = loadint(f);
+  srcnext = 0;
+  sinkbytes = loadint(f);
+  sinksum = loadint(f);
+  nwritev = 0;
+  clock_gettime(CLOCK_MONOTONIC, &started);
+  if (sinkfd < 0)
+    return;
+  if (fstat(sinkfd, &st) < 0 || (size_t)st.st_size < sinkbytes)
+    printf("Warning: %s is missing data delivered before the snapshot\n", sinkpath);
+  if (ftruncate(sinkfd, sinkbytes) < 0 || lseek(sinkfd, 0, SEEK_END) < 0)
+    fail("cannot truncate", sinkpath);
+}
+
+/************************** RUNS *******************/
+void startapp(void)
+{
+  srcoff = 0;
+  srcnext = 0;
+  sinkbytes = 0;
+  sinksum = FNVBASIS;
+  nwritev = 0;
+  if (sinkfd >= 0 && (ftruncate(sinkfd, 0) < 0 || lseek(sinkfd, 0, SEEK_SET) < 0))
+    fail("cannot truncate", sinkpath);
+  clock_gettime(CLOCK_MONOTONIC, &started);
+}
+
+void finishapp(void)
+{
+  struct timespec stopped;
+  double elapsed;
+  uint32_t sum;
+
+  if (!srcopen && sinkfd < 0)
+    return;
+  if (sinkfd >= 0) {
+    flushsink();
+    printf("bytes written to %s:  %lu with %ld writev calls\n",
+           sinkpath, (unsigned long)sinkbytes, nwritev);
+  }
+  /* what the sender never accepted was not sent: compare what it was */
+  if (srcopen) {
+    sum = srcoff == srclen ? srcsum : fnv1a(FNVBASIS, srcmap, srcoff);
+    if (srcoff < srclen)
+      printf("source bytes never accepted by the sender:  %lu of %lu\n",
+             (unsigned long)(srclen - srcoff), (unsigned long)srclen);
+    printf("source checksum %08lx, %lu bytes; delivered checksum %08lx, %lu bytes: %s\n",
+           (unsigned long)sum, (unsigned long)srcoff,
+           (unsigned long)sinksum, (unsigned long)sinkbytes,
+           sum != sinksum || srcoff != sinkbytes ? "MISMATCH" :
+           srcoff == srclen ? "transfer verified" : "partial transfer");
+  }
+  clock_gettime(CLOCK_MONOTONIC, &stopped);
+  elapsed = (stopped.tv_sec - started.tv_sec) + (stopped.tv_nsec - started.tv_nsec) / 1e9;
+  if (elapsed > 0.0)
+    printf("simulated transfer rate:  %f MB per wall clock second\n",
+           sinkbytes / 1e6 / elapsed);
+}
@@ -0,0 +1,31 @@
+/* ******************************************************************
+   Layer 5 application for the emulator: a source that streams a file
+   into messages (-i) and a sink that writes the messages delivered at
+   B to a file (-o), with a checksum comparison of the two at the end.
+   ****************************************************************** */
+
+/* map the input file; returns the number of messages it makes */
+extern long opensource(const char *path);
+/* create the output file; each run starts it afresh */
+extern void opensink(const char *path);
+
+/* rewind the source and truncate the sink at the start of a run */
+extern void startapp(void);
+/* fill in the next message from the source; the last one of a file */
+/* whose size is not a multiple of MSGSIZE is padded with zeros.    */
+/* The source moves past it only once acceptmessage() is called, so */
+/* a message the sender refused is offered again.                   */
+extern void nextmessage(struct msg *);
+extern void acceptmessage(void);
+/* whether the source has bytes that have not been accepted yet */
+extern int sourceleft(void);
+/* a message delivered at B, as passed to deliver() */
+extern void sinkmessage(const struct pkt *, const char *, int);
+/* flush the sink and report on the transfer */
+extern void finishapp(void);
+
+/* the positions of the source and sink, for a snapshot.  Restoring */
+/* needs the same input file, and cuts the output file back to what */
+/* had been delivered when the snapshot was taken.                  */
+extern void saveapp(FILE *);
+extern void loadapp(FILE *);
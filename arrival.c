@@ -0,0 +1,195 @@
+/* ******************************************************************
+   Arrival processes (see arrival.h).  The random processes draw from
+   the backend's uniform random numbers, so a run stays reproducible
+   from its seed; the exponential state times of mmpp and the bursts of
+   onoff are memoryless, so each call starts them afresh.
+   ****************************************************************** */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "emulator.h"
+#include "arrival.h"
+
+#define  PARETOSHAPE  1.5   /* heavy tailed, finite mean, infinite variance */
+
+static double (*uniform)(void);
+static double mean;           /* lambda of the run */
+
+/* a uniform number in (0,1], safe to take the log of */
+static double positive(void)
+{
+  double u = 1.0 - uniform();
+
+  return u > 0.0 ? u : 1e-12;
+}
+
+static double exponential(double m)
+{
+  return -m * log(positive());
+}
+
+static double pareto(double m)
+{
+  double xm = m * (PARETOSHAPE - 1.0) / PARETOSHAPE;
+
+  return xm / pow(positive(), 1.0 / PARETOSHAPE);
+}
+
+static void startrandom(double lambda)
+{
+  mean = lambda;
+}
+
+/************************** UNIFORM / POISSON ******/
+static double nextuniform(void)
+{
+  return mean * uniform() * 2;   /* uniform on [0,2*lambda], mean lambda */
+}
+
+static double nextpoisson(void)
+{
+  return exponential(mean);
+}
+
+/************************** ON/OFF *****************/
+/* on periods average 10 lambda and off periods 30, so the long run mean */
+/* gap is still lambda                                                  */
+#define  ONMEAN   10.0
+#define  OFFMEAN  30.0
+#define  BURST     4.0
+
+static double onleft;         /* time left in the current on period */
+
+static void startonoff(double lambda)
+{
+  mean = lambda;
+  onleft = pareto(ONMEAN * mean);
+}
+
+static double nextonoff(void)
+{
+  double gap = 0.0, x;
+
+  for (;;) {
+    x = exponential(mean / BURST);
+    if (x < onleft) {
+      onleft -= x;
+      return gap + x;
+    }
+    gap += onleft + pareto(OFFMEAN * mean);
+    onleft = pareto(ONMEAN * mean);
+  }
+}
+
+/************************** MMPP *******************/
+/* the quiet state lasts three times as long as the busy one on average, */
+/* which makes the long run mean gap lambda                             */
+static const double mmpprate[2] = { 0.5, 2.5 };     /* per lambda */
+static const double mmppstay[2] = { 60.0, 20.0 };   /* in lambdas */
+static int mmppstate;
+
+static void startmmpp(double lambda)
+{
+  mean = lambda;
+  mmppstate = 0;
+}
+
+static double nextmmpp(void)
+{
+  double gap = 0.0, x, y;
+
+  for (;;) {
+    x = exponential(mean / mmpprate[mmppstate]);
+    y = exponential(mean * mmppstay[mmppstate]);
+    if (x < y)
+      return gap + x;
+    gap += y;
+    mmppstate = !mmppstate;
+  }
+}
+
+/************************** TRACE ******************/
+static FILE *tracefile;
+static const char *tracepath;
+static double lasttime;
+
+static void starttrace(double lambda)
+{
+  rewind(tracefile);
+  lasttime = 0.0;
+}
+
+static double nexttrace(void)
+{
+  double t;
+
+  if (fscanf(tracefile, "%lf", &t) != 1)
+    return -1.0;                 /* end of the trace */
+  if (t < lasttime) {
+    printf("Warning: arrival time %f in %s goes backwards\n", t, tracepath);
+    t = lasttime;
+  }
+  t -= lasttime;
+  lasttime += t;
+  return t;
+}
+
+/************************** SNAPSHOTS **************/
+void savearrivals(FILE *f)
+{
+  savedouble(f, mean);
+  savedouble(f, onleft);
+  saveint(f, mmppstate);
+  saveint(f, tracefile != NULL ? ftell(tracefile) : 0);
+  savedouble(f, lasttime);
+}
+
+void loadarrivals(FILE *f)
+{
+  long pos;
+
+  mean = loaddouble(f);
+  onleft = loaddouble(f);
+  mmppstate = loadint(f);
+  pos = loadint(f);
+  lasttime = loaddouble(f);
+  if (tracefile != NULL && fseek(tracefile, pos, SEEK_SET) < 0) {
+    printf("cannot find the snapshot's place in %s\n", tracepath);
+    exit(EXIT_FAILURE);
+  }
+}
+
+/************************** SELECTION **************/
+static const struct arrivals processes[] = {
+  { "uniform", startrandom, nextuniform },
+  { "poisson", startrandom, nextpoisson },
+  { "onoff", startonoff, nextonoff },
+  { "mmpp", startmmpp, nextmmpp },
+  { "trace", starttrace, nexttrace },
+  { NULL, NULL, NULL }
+};
+
+const struct arrivals *findarrivals(const char *spec, double (*rng)(void))
+{
+  const char *arg = strchr(spec, ':');
+  size_t len = arg != NULL ? (size_t)(arg - spec) : strlen(spec);
+  int i;
+
+  uniform = rng;
+  for (i=0; processes[i].name!=NULL; i++)
+    if (strlen(processes[i].name) == len && strncmp(spec, processes[i].name, len) == 0)
+      break;
+  if (processes[i].name == NULL) {
+    printf("unknown arrival process %s\n", spec);
+    exit(EXIT_FAILURE);
+  }
+  if (processes[i].next == nexttrace) {
+    if (arg == NULL || (tracefile = fopen(arg+1, "r")) == NULL) {
+      printf("arrival trace needs a readable file: -a trace:file\n");
+      exit(EXIT_FAILURE);
+    }
+    tracepath = arg+1;
+  }
+  return &processes[i];
+}
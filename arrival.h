@@ -0,0 +1,27 @@
+/* ******************************************************************
+   Arrival processes for the messages layer 5 hands to A, selected
+   with -a.  lambda stays the mean time between messages for each of
+   the random processes:
+     uniform   gaps uniform on [0, 2*lambda] (the original model)
+     poisson   exponential gaps
+     onoff     Poisson bursts at 4/lambda during Pareto distributed on
+               periods, separated by Pareto distributed off periods
+     mmpp      two state Markov modulated Poisson process, a quiet state
+               at 0.5/lambda and a busy one at 2.5/lambda
+     trace:F   replay of the arrival times (in time units, one per line)
+               recorded in file F, read as it goes
+   ****************************************************************** */
+
+struct arrivals {
+  const char *name;
+  void (*start)(double lambda);   /* reset at the start of a run */
+  double (*next)(void);           /* time to the next arrival, < 0 if none */
+};
+
+/* the process named by spec (name or name:argument); exits with a */
+/* message if there is none.  uniform() supplies the random numbers */
+extern const struct arrivals *findarrivals(const char *spec, double (*uniform)(void));
+
+/* the state of the process in use, for a snapshot */
+extern void savearrivals(FILE *);
+extern void loadarrivals(FILE *);
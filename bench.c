@@ -0,0 +1,435 @@
+/* ******************************************************************
+   BENCHMARK HARNESS
+
+   Runs the emulator over a fixed set of scenarios and its -M
+   microbenchmarks, and compares the results with a stored baseline:
+   - each scenario runs ./rdt as a child with its settings on stdin and
+   records wall time, events simulated per second, peak RSS (from
+   wait4) and the memory allocations and deliveries rdt reports
+   - the microbenchmarks record nanoseconds per call of insertevent,
+   tolayer3 and each engine's checksum, A_input and B_input, with the
+   kernels specialized for the window and forced generic, at the
+   default window and at a 512 packet one, and the same times relative
+   to a calibration loop rdt runs next to each
+   - every figure goes to the results file as a "name metric value"
+   line, after a line naming the host's processor; with -w the results
+   become the new baseline
+   - a memory figure worse than the baseline by more than the threshold,
+   or a change in the number of messages delivered, is a regression,
+   and the harness exits with status 1
+   - timings (events per second and the microbenchmarks' relative
+   costs) move by a third from one minute to the next on a shared
+   machine, even the same one, so they are only reported when they
+   change by more than the threshold; with -g, on a quiet machine, they
+   are regressions too, if the baseline was timed on the same processor
+
+   The coalescing scenarios carry ten messages per packet; the w512
+   scenarios run a 512 packet window over a 1024 sequence space.
+   Build and run with make:
+     make benchmark        compare with bench.baseline
+     make baseline         record a new bench.baseline
+   ****************************************************************** */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/utsname.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#define  MAXRESULTS  256
+#define  MAXOUTPUT   (1 << 16)  /* rdt output kept for parsing */
+#define  MICRORUNS   5          /* microbenchmark runs, the fastest counts */
+
+struct scenario {
+  const char *name;
+  const char *protocol;
+  double loss;
+  double lambda;         /* time between messages */
+  const char *mtu;       /* bytes per packet */
+  const char *flush;     /* time a part filled packet may wait */
+  const char *window;    /* 0 for the engine's own */
+  const char *seqspace;
+};
+
+/* 10^6 messages each.  GBN gets a lighter load: at one message every */
+/* 25 time units it sooner or later falls into retransmission collapse, */
+/* where the event list and the run time grow without bound.  With the  */
+/* large window SR is loaded until the window fills; GBN collapses long */
+/* before its window of 512 fills, so it keeps its light load there.    */
+static const struct scenario scenarios[] = {
+  { "gbn-loss0",           "gbn", 0.0, 100.0, "21",  "0",  "0",   "0" },
+  { "gbn-loss10",          "gbn", 0.1, 100.0, "21",  "0",  "0",   "0" },
+  { "gbn-loss30",          "gbn", 0.3, 100.0, "21",  "0",  "0",   "0" },
+  { "sr-loss0",            "sr",  0.0,  25.0, "21",  "0",  "0",   "0" },
+  { "sr-loss10",           "sr",  0.1,  25.0, "21",  "0",  "0",   "0" },
+  { "sr-loss30",           "sr",  0.3,  25.0, "21",  "0",  "0",   "0" },
+  { "gbn-coalesce-loss10", "gbn", 0.1, 100.0, "210", "50", "0",   "0" },
+  { "sr-coalesce-loss10",  "sr",  0.1,  25.0, "210", "50", "0",   "0" },
+  { "gbn-w512-loss10",     "gbn", 0.1, 100.0, "21",  "0",  "512", "1024" },
+  { "sr-w512-loss10",      "sr",  0.1,   8.0, "21",  "0",  "512", "1024" },
+  { NULL, NULL, 0.0, 0.0, NULL, NULL, NULL, NULL }
+};
+static long messages = 1000000;
+
+/* what a figure means for the comparison */
+#define  HIGHER  0    /* higher is better */
+#define  LOWER   1    /* lower is better */
+#define  EXACT   2    /* must not change */
+#define  INFO    3    /* not compared */
+
+struct result {
+  char name[64];
+  char metric[32];
+  double value;
+};
+
+static struct result results[MAXRESULTS], baseline[MAXRESULTS];
+static int nresults, nbaseline;
+
+static const char *rdt = "./rdt";
+static char host[256];           /* the machine timed, see describehost() */
+static char baselinehost[256];   /* the machine the baseline was timed on */
+
+static void fail(const char *what)
+{
+  perror(what);
+  exit(EXIT_FAILURE);
+}
+
+static double seconds(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int direction(const char *metric)
+{
+  if (strcmp(metric, "events_per_s") == 0)
+    return HIGHER;
+  if (strcmp(metric, "relative_cost") == 0 || strcmp(metric, "maxrss_kb") == 0
+      || strcmp(metric, "allocations") == 0)
+    return LOWER;
+  if (strcmp(metric, "delivered") == 0)
+    return EXACT;
+  return INFO;
+}
+
+/* timings: compared only on the same machine, and gated only with -g */
+static int timing(const char *metric)
+{
+  return strcmp(metric, "events_per_s") == 0 || strcmp(metric, "relative_cost") == 0;
+}
+
+static void record(const char *name, const char *metric, double value)
+{
+  if (nresults == MAXRESULTS) {
+    printf("too many results\n");
+    exit(EXIT_FAILURE);
+  }
+  strncpy(results[nresults].name, name, sizeof(results[0].name) - 1);
+  strncpy(results[nresults].metric, metric, sizeof(results[0].metric) - 1);
+  results[nresults++].value = value;
+}
+
+/********************** RUNNING RDT *******************/
+/* run rdt with the arguments given, feeding it input; its output is */
+/* returned and its resource usage left in ru                        */
+static char *runrdt(char *const argv[], const char *input, struct rusage *ru, double *wall)
+{
+  static char output[MAXOUTPUT];
+  int in[2], out[2], status;
+  size_t used = 0;
+  ssize_t n;
+  double start;
+  pid_t pid;
+
+  if (pipe(in) < 0 || pipe(out) < 0)
+    fail("pipe");
+  start = seconds();
+  if ((pid = fork()) < 0)
+    fail("fork");
+  if (pid == 0) {
+    dup2(in[0], STDIN_FILENO);
+    dup2(out[1], STDOUT_FILENO);
+    close(in[0]);
+    close(in[1]);
+    close(out[0]);
+    close(out[1]);
+    execv(rdt, argv);
+    perror(rdt);
+    _exit(127);
+  }
+  close(in[0]);
+  close(out[1]);
+  if (write(in[1], input, strlen(input)) < 0)
+    fail("write");
+  close(in[1]);
+  /* keep the last MAXOUTPUT bytes, where the report is */
+  while ((n = read(out[0], output + used, MAXOUTPUT - 1 - used)) != 0) {
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      fail("read");
+    }
+    used += n;
+    if (used == MAXOUTPUT - 1) {
+      memmove(output, output + used / 2, used - used / 2);
+      used -= used / 2;
+    }
+  }
+  close(out[0]);
+  if (wait4(pid, &status, 0, ru) < 0)
+    fail("wait4");
+  *wall = seconds() - start;
+  output[used] = '\0';
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    printf("%s failed:\n%s\n", rdt, output);
+    exit(EXIT_FAILURE);
+  }
+  return output;
+}
+
+/* the number after label in rdt's output */
+static double field(const char *output, const char *label)
+{
+  const char *p = strstr(output, label);
+
+  if (p == NULL) {
+    printf("rdt did not report \"%s\"\n", label);
+    exit(EXIT_FAILURE);
+  }
+  return atof(p + strlen(label));
+}
+
+static void runscenario(const struct scenario *s)
+{
+  char *argv[] = { (char *)rdt, "-p", (char *)s->protocol, "-m", (char *)s->mtu,
+                   "-f", (char *)s->flush, "-w", (char *)s->window, "-q", (char *)s->seqspace, NULL };
+  char input[128], *output;
+  struct rusage ru;
+  double wall, events, eventallocs, blocks;
+
+  /* messages, loss, corruption, direction (asked only with loss), lambda, trace */
+  if (s->loss > 0.0)
+    sprintf(input, "%ld\n%f\n0.0\n2\n%f\n0\n", messages, s->loss, s->lambda);
+  else
+    sprintf(input, "%ld\n0.0\n0.0\n%f\n0\n", messages, s->lambda);
+  output = runrdt(argv, input, &ru, &wall);
+  events = field(output, "number of events simulated:");
+  eventallocs = field(output, "memory allocations:");
+  blocks = field(strstr(output, "memory allocations:"), "events,");
+  record(s->name, "wall_s", wall);
+  record(s->name, "events_per_s", events / wall);
+  record(s->name, "maxrss_kb", ru.ru_maxrss);
+  record(s->name, "allocations", eventallocs + blocks);
+  record(s->name, "delivered", field(output, "number of messages delivered to application:"));
+  printf("%-20s %8.3f s %12.0f events/s %8ld KB %10.0f allocations\n",
+         s->name, wall, events / wall, ru.ru_maxrss, eventallocs + blocks);
+}
+
+static int cmpdouble(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* a few ns per call is within the noise of one run, so the routines */
+/* are timed MICRORUNS times; the fastest time of each is kept, and  */
+/* the median relative cost, the time over that of rdt's calibration */
+/* loop.  Only the relative cost is compared: the ns per call move   */
+/* with the machine's speed from one minute to the next              */
+static void runmicro(char **argv)
+{
+  static char names[MAXRESULTS][64];
+  static double ns[MAXRESULTS], relative[MAXRESULTS][MICRORUNS];
+  char name[64], *line, *output;
+  struct rusage ru;
+  double wall, t, r;
+  int run, nmicro = 0, i;
+
+  argv[0] = (char *)rdt;
+  for (run=0; run<MICRORUNS; run++) {
+    output = runrdt(argv, "", &ru, &wall);
+    for (line = strtok(output, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+      if (sscanf(line, "micro %63s %lf %lf", name, &t, &r) != 3)
+        continue;
+      for (i=0; i<nmicro && strcmp(names[i], name)!=0; i++)
+        ;
+      if (i == nmicro) {
+        if (run > 0 || nmicro == MAXRESULTS)
+          continue;
+        strcpy(names[nmicro++], name);
+        ns[i] = t;
+      }
+      else if (t < ns[i])
+        ns[i] = t;
+      relative[i][run] = r;
+    }
+  }
+  for (i=0; i<nmicro; i++) {
+    qsort(relative[i], MICRORUNS, sizeof(double), cmpdouble);
+    record(names[i], "ns_per_call", ns[i]);
+    record(names[i], "relative_cost", relative[i][MICRORUNS / 2]);
+    printf("%-30s %8.1f ns per call %8.2f relative\n", names[i], ns[i],
+           relative[i][MICRORUNS / 2]);
+  }
+}
+
+/********************** RESULTS ***********************/
+/* the processor model, count and architecture: what the timings depend on */
+static void describehost(void)
+{
+  struct utsname u;
+  char line[256], *model = NULL, *p;
+  FILE *f = fopen("/proc/cpuinfo", "r");
+
+  if (f != NULL) {
+    while (model == NULL && fgets(line, sizeof(line), f) != NULL)
+      if (strncmp(line, "model name", 10) == 0 && (p = strchr(line, ':')) != NULL) {
+        model = p + 1 + strspn(p + 1, " \t");
+        model[strcspn(model, "\n")] = '\0';
+      }
+    fclose(f);
+  }
+  if (uname(&u) < 0)
+    strcpy(u.machine, "unknown");
+  snprintf(host, sizeof(host), "%s, %ld cpus, %s", model != NULL ? model : "unknown cpu",
+           sysconf(_SC_NPROCESSORS_ONLN), u.machine);
+}
+
+static void writeresults(const char *path)
+{
+  FILE *f = fopen(path, "w");
+  int i;
+
+  if (f == NULL)
+    fail(path);
+  fprintf(f, "# host %s\n", host);
+  fprintf(f, "# name metric value\n");
+  for (i=0; i<nresults; i++)
+    fprintf(f, "%s %s %.10g\n", results[i].name, results[i].metric, results[i].value);
+  if (fclose(f) != 0)
+    fail(path);
+}
+
+static int readbaseline(const char *path)
+{
+  FILE *f = fopen(path, "r");
+  char line[256];
+
+  if (f == NULL)
+    return 0;
+  while (fgets(line, sizeof(line), f) != NULL && nbaseline < MAXRESULTS) {
+    if (strncmp(line, "# host ", 7) == 0) {
+      strncpy(baselinehost, line + 7, sizeof(baselinehost) - 1);
+      baselinehost[strcspn(baselinehost, "\n")] = '\0';
+    }
+    if (line[0] == '#')
+      continue;
+    if (sscanf(line, "%63s %31s %lf", baseline[nbaseline].name,
+               baseline[nbaseline].metric, &baseline[nbaseline].value) == 3)
+      nbaseline++;
+  }
+  fclose(f);
+  return 1;
+}
+
+/* compare every result with the baseline; returns the number of regressions */
+static int compare(double threshold, int gatetimings)
+{
+  const struct result *r, *b;
+  double change;
+  int i, j, dir, worse, regressions = 0, samehost = strcmp(host, baselinehost) == 0;
+
+  if (!samehost)
+    printf("the baseline was timed on %s, this is %s: timings are not compared\n",
+           *baselinehost ? baselinehost : "an unrecorded machine", host);
+  for (i=0; i<nresults; i++) {
+    r = &results[i];
+    dir = direction(r->metric);
+    for (j=0, b=NULL; j<nbaseline && b==NULL; j++)
+      if (strcmp(baseline[j].name, r->name) == 0 && strcmp(baseline[j].metric, r->metric) == 0)
+        b = &baseline[j];
+    if (b == NULL || dir == INFO || (timing(r->metric) && !samehost))
+      continue;
+    change = b->value != 0.0 ? (r->value - b->value) / b->value : 0.0;
+    worse = (dir == HIGHER && change < -threshold) || (dir == LOWER && change > threshold)
+            || (dir == EXACT && r->value != b->value);
+    if (!worse)
+      continue;
+    if (timing(r->metric) && !gatetimings) {
+      printf("slower     %s %s: %.6g against %.6g in the baseline (%+.1f%%, timing, not gated)\n",
+             r->name, r->metric, r->value, b->value, 100.0 * change);
+      continue;
+    }
+    printf("REGRESSION %s %s: %.6g against %.6g in the baseline (%+.1f%%)\n",
+           r->name, r->metric, r->value, b->value, 100.0 * change);
+    regressions++;
+  }
+  return regressions;
+}
+
+int main(int argc, char **argv)
+{
+  char *microargs[] = { NULL, "-M", "-p", "all", NULL };
+  char *largemicroargs[] = { NULL, "-M", "-p", "all", "-w", "512", "-q", "1024", NULL };
+  const char *resultpath = "bench.out", *baselinepath = "bench.baseline";
+  double threshold = 0.25;     /* well above the run to run noise of the memory figures */
+  int i, writebaseline = 0, micro = 1, gatetimings = 0, regressions;
+
+  for (i=1; i<argc; i++) {
+    if (strcmp(argv[i], "-r") == 0 && i+1 < argc)
+      rdt = argv[++i];
+    else if (strcmp(argv[i], "-o") == 0 && i+1 < argc)
+      resultpath = argv[++i];
+    else if (strcmp(argv[i], "-b") == 0 && i+1 < argc)
+      baselinepath = argv[++i];
+    else if (strcmp(argv[i], "-t") == 0 && i+1 < argc)
+      threshold = atof(argv[++i]) / 100.0;
+    else if (strcmp(argv[i], "-n") == 0 && i+1 < argc)
+      messages = atol(argv[++i]);
+    else if (strcmp(argv[i], "-w") == 0)
+      writebaseline = 1;
+    else if (strcmp(argv[i], "-S") == 0)
+      micro = 0;
+    else if (strcmp(argv[i], "-g") == 0)
+      gatetimings = 1;
+    else {
+      printf("usage: %s [-r rdt] [-o results] [-b baseline] [-t threshold %%]\n"
+             "          [-n messages] [-S (scenarios only)] [-g (gate timings too)]\n"
+             "          [-w (write baseline)]\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  describehost();
+  for (i=0; scenarios[i].name!=NULL; i++)
+    runscenario(&scenarios[i]);
+  if (micro) {
+    runmicro(microargs);
+    runmicro(largemicroargs);
+  }
+  writeresults(resultpath);
+
+  if (writebaseline) {
+    writeresults(baselinepath);
+    printf("baseline written to %s\n", baselinepath);
+    return EXIT_SUCCESS;
+  }
+  if (!readbaseline(baselinepath)) {
+    printf("no baseline in %s, nothing to compare\n", baselinepath);
+    return EXIT_SUCCESS;
+  }
+  regressions = compare(threshold, gatetimings);
+  printf("%d regression%s against %s (threshold %.0f%%)\n",
+         regressions, regressions == 1 ? "" : "s", baselinepath, 100.0 * threshold);
+  return regressions > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
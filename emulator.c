@@ -33,17 +33,64 @@
    soon as n packets are sent.
    - fixed C style to adhere to current programming style
 
+   Modifications:
+   - the GBN and SR protocol engines are both linked into one program
+   (gcc -o rdt emulator.c packet.c app.c arrival.c gbn.c sr.c -lm) and dispatched through struct
+   protocol; -p chooses which to run, several run in turn on the same seed
+   - layer 5 can stream a file (-i) and write what B receives to another
+   (-o), checking that the transfer was byte-exact (app.c); a message
+   refused at a full window is offered again with the next arrival, so
+   the number of messages entered may exceed the file's to give it room,
+   and arrivals stop once the whole file has been accepted
+   - the time between messages follows the arrival process chosen with
+   -a: uniform as before, poisson, onoff, mmpp or a trace (arrival.c)
+   - the whole simulation can be saved to a snapshot every -N events
+   (-S names the file) and resumed from one with -R; a resumed run goes
+   on exactly as the original would have
+   - -M times the hot routines on their own instead of simulating, for
+   the benchmark harness (bench.c)
+   - -x writes the counters of each run as JSON or CSV, with a sample of
+   them and of the window occupancy every -T time units
+   - the delay of each message from layer 5 at A to layer 5 at B is
+   measured and its mean and percentiles reported; -s sets the seed, so
+   the Monte Carlo driver (mc.c) can run independent replications
+   - built with -DPROFILE (make rdt-prof), each run ends with a breakdown
+   of where its time went and the percentiles of the event list length,
+   and -F writes the same breakdown as collapsed stacks for a flame graph
+   - -w and -q set the window and sequence space of either engine at run
+   time; the engines run a kernel specialized for the sizes where they
+   have one, and -M times each against the generic one
+   - timers are cancelled lazily: a stopped or restarted timer leaves its
+   event on the list, to be dropped or moved on when it comes to the
+   front, and the list operations this saves are reported
+   - -b caps the memory selective repeat's receiver may hold out of
+   order, in whole pool buffers, and -B chooses what happens at the
+   cap: drop the packet, or also advertise the room left in each ACK so
+   the sender holds back
+
    ********************************************************************* */
+#define _POSIX_C_SOURCE 200809L
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
 #include "emulator.h"
-#include "gbn.h"
+#include "app.h"
+#include "arrival.h"
+
+/* Simulated time is kept as a 64-bit count of clock ticks so that it does
+   not lose resolution however long the run; TICKS ticks make one time unit
+   (the unit of RTT, lambda and the channel delay). */
+#define  TICKS  1000000.0
 
 struct event {
-  float evtime;           /* event time */
+  int64_t evtime;         /* event time, in ticks */
+  uint64_t evseq;         /* insertion order, breaks ties between equal times */
+  uint32_t evgen;         /* for a timer, the generation it was scheduled in */
   int evtype;             /* event type code */
   int eventity;           /* entity where event occurs */
-  struct pkt *pktptr;     /* ptr to packet (if any) assoc w/ this event */
+  const struct pkt *pktptr; /* ptr to packet (if any) assoc w/ this event */
   struct event *prev;
   struct event *next;
 };
@@ -54,47 +101,186 @@ struct event *evlist = NULL;   /* the event list */
 #define  TIMER_INTERRUPT 0  
 #define  FROM_LAYER5     1
 #define  FROM_LAYER3     2
+#define  FLUSH_TIMER     3
 
 #define  OFF             0
 #define  ON              1
 
-int TRACE = 3;
+/* Timers are cancelled lazily.  Stopping a timer only marks it stopped, */
+/* and restarting it only moves its deadline, while the event standing  */
+/* for it stays on the list; when that event comes to the front it is   */
+/* dropped if the timer is stopped, or put back in at the new deadline. */
+/* A new event is scheduled only when the deadline moves earlier than   */
+/* the one on the list, which is orphaned by a new generation.          */
+struct timer {
+  int running;
+  int64_t deadline;       /* when it goes off, in ticks */
+  uint64_t seq;           /* insertion number it was started with */
+  uint32_t gen;           /* generation of the event standing for it */
+  int64_t pending;        /* time of that event, -1 if there is none */
+};
+
+#define  TIMERNO(evtype)  ((evtype) == FLUSH_TIMER)
+static struct timer timers[2][2];  /* retransmission and flush timer of A and B */
 
-/* statistics updated by GBN */
-int window_full;   /* count of the number of messages dropped due to full window */
-int total_ACKs_received;
-int packets_resent;       /* count of the number of packets resent  */
-int new_ACKs;           /* count of the number of acks correctly received */
-int packets_received;  /* count of the packets received by receiver */
+/* the places the profiler times (see PROFILER below) */
+#define  PROF_RUN            0   /* the whole event loop */
+#define  PROF_FROM_LAYER5    1   /* dispatch branches */
+#define  PROF_FROM_LAYER3    2
+#define  PROF_TIMER          3
+#define  PROF_FLUSH          4
+#define  PROF_INSERTEVENT    5
+#define  PROF_TOLAYER3       6
+#define  PROF_TOLAYER5       7
+#define  PROF_STARTTIMER     8
+#define  PROF_STOPTIMER      9
+#define  PROF_STARTFLUSH    10
+#define  PROF_STOPFLUSH     11
+#define  PROF_SITES         12
+
+/* without PROFILE the hooks compile to nothing */
+#ifdef PROFILE
+static void profenter(int site);
+static void profexit(void);
+static long evlength;             /* events on the list */
+#define  PROFENTER(site)   profenter(site)
+#define  PROFEXIT()        profexit()
+#define  PROFLENGTH(n)     (evlength += (n))
+#else
+#define  PROFENTER(site)
+#define  PROFEXIT()
+#define  PROFLENGTH(n)
+#endif
+
+/* the protocol engines chosen with -p to run in turn */
+#define  MAXRUNS  8
+static const struct protocol *runs[MAXRUNS];
+static int nruns = 0;
+static const struct protocol *proto;   /* engine of the current run */
+static const char *sourcepath = NULL;  /* -i: file layer 5 sends */
+static const char *arrivalspec = "uniform";
+static const struct arrivals *arrivals;  /* -a: when layer 5 sends */
+static int64_t lastarrival;       /* time the last message was handed to A */
 
 /* statistics updated by emulator */
-static int packets_lost;  
-static int packets_corrupt;
-static int packets_sent;
-static int packets_timeout;
-static int messages_delivered;
-
-static int nsim = 0;              /* number of messages from 5 to 4 so far */ 
-static int nsimmax = 0;           /* number of msgs to generate, then stop */
-static float time = 0.000;
-static float lossprob;            /* probability that a packet is dropped  */
-static float corruptprob;   /* probability that one bit is packet is flipped */
+static long packets_timeout;      /* retransmission timers gone off */
+static long messages_delivered;
+static long bytes_delivered;
+
+static long nsim = 0;             /* number of messages from 5 to 4 so far */ 
+static long nsimmax = 0;          /* number of msgs to generate, then stop */
+static int64_t now = 0;           /* current time, in ticks */
+static uint64_t nextevseq = 0;    /* insertion number for the next event */
+static double lossprob;           /* probability that a packet is dropped  */
+static double corruptprob;  /* probability that one bit is packet is flipped */
 static int corruptdirection; /* A->B A<-B or bidirectional corruption/loss */
-static float lambda;        /* arrival rate of messages from layer 5 */   
-static int   ntolayer3;           /* number sent into layer 3 */
-static int   nlost;               /* number lost in media */
-static int ncorrupt;              /* number corrupted by media*/
+static double lambda;       /* arrival rate of messages from layer 5 */   
+static long  ntolayer3;           /* number sent into layer 3 */
+static long  nlost;               /* number lost in media */
+static long ncorrupt;             /* number corrupted by media*/
+static long  nevents;             /* number of events simulated */
+static long  nevallocs;           /* number of events allocated */
+static long  ntimercalls;         /* timer starts and stops that took effect */
+static long  ntimerops;           /* event list insertions and removals for them */
+
+/* every counter of a run, as saved in a snapshot and exported with -x */
+static const struct {
+  const char *name;
+  long *value;
+} counters[] = {
+  { "window_full", &window_full },
+  { "total_ACKs_received", &total_ACKs_received },
+  { "packets_resent", &packets_resent },
+  { "new_ACKs", &new_ACKs },
+  { "packets_received", &packets_received },
+  { "parity_sent", &parity_sent },
+  { "packets_recovered", &packets_recovered },
+  { "recv_dropped", &recv_dropped },
+  { "recv_peak", &recv_peak },
+  { "packets_timeout", &packets_timeout },
+  { "messages_delivered", &messages_delivered },
+  { "bytes_delivered", &bytes_delivered },
+  { "ntolayer3", &ntolayer3 },
+  { "nlost", &nlost },
+  { "ncorrupt", &ncorrupt },
+  { "nevents", &nevents },
+  { "timer_calls", &ntimercalls },
+  { "timer_list_ops", &ntimerops }
+};
+#define  NCOUNTERS  (sizeof(counters) / sizeof(counters[0]))
+
+/* snapshots */
+#define  SNAPMAGIC  "rdtsnap6"
+static const char *snappath = "rdt.snap";  /* -S: where snapshots go */
+static long snapevery = 0;        /* -N: events between snapshots, 0 for none */
+static FILE *resumefrom = NULL;   /* -R: snapshot the run resumes from */
+static int microbench = 0;        /* -M: run the microbenchmarks */
+static long poolstart;            /* poolblocks when the run started */
+static long seed = 9999;          /* -s: seed of the random numbers */
+static void resetdelays(void);    /* see MESSAGE DELAYS */
+static void resettimers(void);    /* see the timers below */
+
+/* convert a duration in time units to ticks, and ticks to time units */
+static int64_t toticks(double units)
+{
+  return (int64_t)(units * TICKS + 0.5);
+}
+
+static double tounits(int64_t ticks)
+{
+  return ticks / TICKS;
+}
+
+/* The emulator's own random number generator, so that its state can go */
+/* into a snapshot: the additive feedback generator behind glibc's rand() */
+/* (x[i] = x[i-31] + x[i-3], seeded by a Lehmer sequence), which keeps    */
+/* the numbers, and so the results, of earlier versions.                  */
+#define  RNGDEG   31
+#define  RNGSEP    3
+#define  RNGMAX   2147483647.0   /* largest number it returns */
+
+static uint32_t rngstate[RNGDEG];
+static int rngfront, rngrear;    /* rngfront runs RNGSEP ahead of rngrear */
+
+static long rngnext(void)
+{
+  uint32_t val = rngstate[rngfront] += rngstate[rngrear];
+
+  rngfront = (rngfront + 1) % RNGDEG;
+  rngrear = (rngrear + 1) % RNGDEG;
+  return val >> 1;
+}
+
+static void rngseed(long seed)
+{
+  long word = seed != 0 ? seed : 1, hi, lo;
+  int i;
+
+  rngstate[0] = word;
+  for (i=1; i<RNGDEG; i++) {
+    hi = word / 127773;
+    lo = word % 127773;
+    word = 16807 * lo - 2836 * hi;
+    if (word < 0)
+      word += 2147483647;
+    rngstate[i] = word;
+  }
+  rngfront = RNGSEP;
+  rngrear = 0;
+  for (i=0; i<10*RNGDEG; i++)
+    rngnext();
+}
 
 /****************************************************************************/
 /* jimsrand(): return a double in range [0,1].  The routine below is used to */
 /* isolate all random number generation in one location.  We assume that the*/
-/* system-supplied rand() function return an int in therange [0,mmm]        */
+/* generator returns an int in the range [0,mmm]                            */
 /****************************************************************************/
 double jimsrand(void) 
 {
-  double mmm = RAND_MAX;     /* largest int  - MACHINE DEPENDENT!!!!!!!!   */
+  double mmm = RNGMAX;       /* largest int */
   double x;                   
-  x = rand()/mmm;            /* x should be uniform in [0,1] */
+  x = rngnext()/mmm;         /* x should be uniform in [0,1] */
   if (TRACE > 3)
     printf("RANDOM NUMBER GENERAION CALLED: %f\n", x);
   return(x);
@@ -104,13 +290,29 @@ double jimsrand(void)
 /*  The next set of routines handle the event list   */
 /*****************************************************/
 
-void insertevent(struct event *p)
+/* a new event for the list, counted as a memory allocation */
+static struct event *newevent(void)
+{
+  struct event *evptr = malloc(sizeof(struct event));
+
+  if (evptr == 0) {
+    printf("memory allocation for event failed.");
+    exit(EXIT_FAILURE);
+  }
+  nevallocs++;
+  return evptr;
+}
+
+/* put p on the list in order of time and, at the same time, of evseq */
+static void placeevent(struct event *p)
 {
   struct event *q,*qold;
 
+  PROFENTER(PROF_INSERTEVENT);
+  PROFLENGTH(1);
   if (TRACE>2) {
-    printf("            INSERTEVENT: time is %f\n",time);
-    printf("            INSERTEVENT: future time will be %f\n",p->evtime); 
+    printf("            INSERTEVENT: time is %f\n",tounits(now));
+    printf("            INSERTEVENT: future time will be %f\n",tounits(p->evtime)); 
   }
   q = evlist;     /* q points to front of list in which p struct inserted */
   if (q==NULL) {   /* list is empty */
@@ -119,7 +321,8 @@ void insertevent(struct event *p)
     p->prev=NULL;
   }
   else {
-    for (qold = q; q !=NULL && p->evtime > q->evtime; q=q->next)
+    for (qold = q; q !=NULL && (p->evtime > q->evtime
+                                || (p->evtime == q->evtime && p->evseq > q->evseq)); q=q->next)
       qold=q; 
     if (q==NULL) {   /* end of list */
       qold->next = p;
@@ -139,6 +342,13 @@ void insertevent(struct event *p)
       q->prev=p;
     }
   }
+  PROFEXIT();
+}
+
+void insertevent(struct event *p)
+{
+  p->evseq = nextevseq++;  /* later insertions go after earlier ones at the same time */
+  placeevent(p);
 }
 
 void generate_next_arrival(void)
@@ -149,14 +359,14 @@ void generate_next_arrival(void)
   if (TRACE>2)
     printf("          GENERATE NEXT ARRIVAL: creating new arrival\n");
  
-  x = lambda*jimsrand()*2;  /* x is uniform on [0,2*lambda] */
-  /* having mean of lambda        */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
+  x = arrivals->next();     /* mean of lambda, except for a trace */
+  if (x < 0.0) {
+    if (TRACE>2)
+      printf("          GENERATE NEXT ARRIVAL: arrival trace has ended\n");
+    return;
   }
-  evptr->evtime =  time + x;
+  evptr = newevent();
+  evptr->evtime =  now + toticks(x);
   evptr->evtype =  FROM_LAYER5;
   if (BIDIRECTIONAL && (jimsrand()>0.5) )
     evptr->eventity = B;
@@ -170,34 +380,44 @@ void printevlist(void)
   struct event *q;
   printf("--------------\nEvent List Follows:\n");
   for(q = evlist; q!=NULL; q=q->next) {
-    printf("Event time: %f, type: %d entity: %d\n",q->evtime,q->evtype,q->eventity);
+    printf("Event time: %f, type: %d entity: %d\n",tounits(q->evtime),q->evtype,q->eventity);
   }
   printf("--------------\n");
 }
 
-void init(void)                         /* initialize the simulator */
+void readparams(void)                   /* read the network settings */
 {
-  float sum, avg;
-  int i;
+  long i;
 
   printf("-----  Stop and Wait Network Simulator Version 1.1 -------- \n\n");
   printf("Enter the number of messages to simulate: ");
-  scanf("%d",&nsimmax);
+  scanf("%ld",&nsimmax);
+  if (sourcepath != NULL) {
+    i = opensource(sourcepath);
+    if (nsimmax < i)
+      nsimmax = i;
+    printf("(%s makes %ld messages, offered in at most %ld arrivals)\n", sourcepath, i, nsimmax);
+  }
   printf("Enter  packet loss probability [enter 0.0 for no loss]:");
-  scanf("%f",&lossprob);
+  scanf("%lf",&lossprob);
   printf("Enter packet corruption probability [0.0 for no corruption]:");
-  scanf("%f",&corruptprob);
+  scanf("%lf",&corruptprob);
   if (lossprob != 0.0 || corruptprob != 0.0) {
     printf("If you want loss or corruption to only occur in one direction, choose the direction: 0 A->B, 1 A<-B, 2 A<->B (both directions) :");
     scanf("%d",&corruptdirection);
   }
   printf("Enter average time between messages from sender's layer5 [ > 0.0]:");
-  scanf("%f",&lambda);
+  scanf("%lf",&lambda);
   printf("Enter TRACE:");
   scanf("%d",&TRACE);
+}
 
+void init(void)                         /* initialize the simulator */
+{
+  float sum, avg;
+  int i;
 
-  srand(9999);              /* init random number generator */
+  rngseed(seed);            /* init random number generator */
   sum = 0.0;                /* test random number generator for students */
   for (i=0; i<1000; i++)
     sum+=jimsrand();    /* jimsrand() should be uniform in [0,1] */
@@ -215,94 +435,292 @@ void init(void)                         /* initialize the simulator */
   packets_resent = 0;
   new_ACKs = 0;
   packets_received = 0;
-  packets_lost = 0;  
-  packets_corrupt = 0;
-  packets_sent = 0;
+  parity_sent = 0;
+  packets_recovered = 0;
+  recv_dropped = 0;
+  recv_peak = 0;
   packets_timeout = 0;
   messages_delivered = 0;
+  bytes_delivered = 0;
 
   ntolayer3 = 0;
   nlost = 0;
   ncorrupt = 0;
+  nevents = 0;
+  nevallocs = 0;
+  ntimercalls = 0;
+  ntimerops = 0;
+  poolstart = poolblocks;
 
-  time=0.0;                    /* initialize time to 0.0 */
+  resetdelays();
+  nsim = 0;
+  now=0;                       /* initialize time to 0.0 */
+  nextevseq=0;
+  resettimers();
+  lastarrival=0;
+  arrivals->start(lambda);
   generate_next_arrival();     /* initialize event list */
 }
 
 /********************** Student-callable ROUTINES ***********************/
 
-/* called by students routine to cancel a previously-started timer */
-void stoptimer(int AorB)
-/* A or B is trying to stop timer */
+/* stop the timer or flush timer (evtype) of A or B; its event is left */
+/* on the list for nextevent() to drop                                 */
+static void canceltimer(int AorB, int evtype)
 {
-  struct event *q;
+  struct timer *t = &timers[AorB][TIMERNO(evtype)];
 
   if (TRACE>1)
-    printf("          STOP TIMER: stopping timer at %f\n",time);
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-  for (q=evlist; q!=NULL ; q = q->next) 
-    if ( (q->evtype==TIMER_INTERRUPT  && q->eventity==AorB) ) { 
-      /* remove this event */
-      if (q->next==NULL && q->prev==NULL)
-        evlist=NULL;         /* remove first and only event on list */
-      else if (q->next==NULL) /* end of list - there is one in front */
-        q->prev->next = NULL;
-      else if (q==evlist) { /* front of list - there must be event after */
-        q->next->prev=NULL;
-        evlist = q->next;
-      }
-      else {     /* middle of list */
-        q->next->prev = q->prev;
-        q->prev->next =  q->next;
-      }
+    printf("          STOP %sTIMER: stopping timer at %f\n",
+           evtype==FLUSH_TIMER ? "FLUSH " : "", tounits(now));
+  if (!t->running) {
+    printf("Warning: unable to cancel your timer. It wasn't running.\n");
+    return;
+  }
+  t->running = 0;
+  ntimercalls++;
+}
+
+/* start the timer or flush timer (evtype) of A or B.  An event already */
+/* on the list for it that goes off no later is moved on when it does.  */
+static void scheduletimer(int AorB, int evtype, double increment)
+{
+  struct timer *t = &timers[AorB][TIMERNO(evtype)];
+  struct event *evptr;
+
+  if (TRACE>1)
+    printf("          START %sTIMER: starting timer at %f\n",
+           evtype==FLUSH_TIMER ? "FLUSH " : "", tounits(now));
+  /* be nice: check to see if timer is already started, if so, then  warn */
+  if (t->running) {
+    printf("Warning: attempt to start a timer that is already started\n");
+    return;
+  }
+  t->running = 1;
+  t->deadline = now + toticks(increment);
+  t->seq = nextevseq++;           /* where an eager insertion would have gone */
+  ntimercalls++;
+  if (t->pending >= 0 && t->pending <= t->deadline)
+    return;
+  if (t->pending >= 0)
+    t->gen++;                     /* orphan the later event */
+
+  /* create future event for when timer goes off */
+  evptr = newevent();
+  evptr->evtime = t->deadline;
+  evptr->evseq = t->seq;
+  evptr->evgen = t->gen;
+  evptr->evtype = evtype;
+  evptr->eventity = AorB;
+  placeevent(evptr);
+  t->pending = t->deadline;
+  ntimerops++;
+}
+
+/* the next event to simulate, after taking timer events that no longer */
+/* stand for a running timer off the front of the list: those of a      */
+/* stopped or orphaned timer are dropped, and those of a timer that was */
+/* restarted go back in at its deadline.  NULL when the list is empty.  */
+static struct event *nextevent(void)
+{
+  struct event *q;
+  struct timer *t;
+
+  while ((q = evlist) != NULL && (q->evtype == TIMER_INTERRUPT || q->evtype == FLUSH_TIMER)) {
+    t = &timers[q->eventity][TIMERNO(q->evtype)];
+    if (q->evgen == t->gen && t->running && q->evtime == t->deadline && q->evseq == t->seq)
+      break;                      /* goes off */
+    evlist = q->next;
+    if (evlist != NULL)
+      evlist->prev = NULL;
+    PROFLENGTH(-1);
+    ntimerops++;
+    if (q->evgen == t->gen && t->running) {
+      q->evtime = t->deadline;
+      q->evseq = t->seq;
+      t->pending = t->deadline;
+      placeevent(q);
+      ntimerops++;
+    }
+    else {
+      if (q->evgen == t->gen)
+        t->pending = -1;
       free(q);
-      return;
     }
-  printf("Warning: unable to cancel your timer. It wasn't running.\n");
+  }
+  return q;
+}
+
+/* a timer event has come to the front and is being handled */
+static void timerfired(const struct event *q)
+{
+  struct timer *t = &timers[q->eventity][TIMERNO(q->evtype)];
+
+  t->running = 0;
+  t->pending = -1;
+}
+
+/* no timer running and no event on the list for any */
+static void resettimers(void)
+{
+  int AorB, i;
+
+  for (AorB=A; AorB<=B; AorB++)
+    for (i=0; i<2; i++) {
+      timers[AorB][i].running = 0;
+      timers[AorB][i].pending = -1;
+      timers[AorB][i].gen = 0;
+    }
+}
+
+/* called by students routine to cancel a previously-started timer */
+void stoptimer(int AorB)
+/* A or B is trying to stop timer */
+{
+  PROFENTER(PROF_STOPTIMER);
+  canceltimer(AorB, TIMER_INTERRUPT);
+  PROFEXIT();
 }
 
 
 void starttimer(int AorB, double increment)
 /* A or B is trying to start timer */
 {
+  PROFENTER(PROF_STARTTIMER);
+  scheduletimer(AorB, TIMER_INTERRUPT, increment);
+  PROFEXIT();
+}
 
-  struct event *q;
-  struct event *evptr;
+void stopflushtimer(int AorB)
+{
+  PROFENTER(PROF_STOPFLUSH);
+  canceltimer(AorB, FLUSH_TIMER);
+  PROFEXIT();
+}
 
-  if (TRACE>1)
-    printf("          START TIMER: starting timer at %f\n",time);
-  /* be nice: check to see if timer is already started, if so, then  warn */
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-  for (q=evlist; q!=NULL ; q = q->next)  
-    if ( (q->evtype==TIMER_INTERRUPT  && q->eventity==AorB) ) { 
-      printf("Warning: attempt to start a timer that is already started\n");
-      return;
+void startflushtimer(int AorB, double increment)
+{
+  PROFENTER(PROF_STARTFLUSH);
+  scheduletimer(AorB, FLUSH_TIMER, increment);
+  PROFEXIT();
+}
+
+
+/************************** MESSAGE DELAYS *********/
+/* The engines deliver in order, so the messages A accepts (those not */
+/* dropped for a full window) reach B's layer 5 first in, first out:  */
+/* their arrival times wait in a queue and each delivery at B takes   */
+/* the oldest.  Delays go into a log-linear histogram, DELAYSUB bits  */
+/* of the tick count below its leading bit, so percentiles are within */
+/* 1% with memory that does not grow with the run.                    */
+#define  DELAYSUB      7
+#define  DELAYBUCKETS  ((64 - DELAYSUB + 1) << DELAYSUB)
+
+static int64_t *waiting;          /* arrival times of the messages in transit */
+static long waitsize, waitfirst, nwaiting;
+static long delayhist[DELAYBUCKETS];
+static long ndelays;
+static double delaysum;           /* in ticks */
+static int64_t delaymax;
+
+static void resetdelays(void)
+{
+  int i;
+
+  for (i=0; i<DELAYBUCKETS; i++)
+    delayhist[i] = 0;
+  ndelays = 0;
+  delaysum = 0.0;
+  delaymax = 0;
+  waitfirst = nwaiting = 0;
+}
+
+/* a message arriving now has been accepted by A */
+static void messagesent(int64_t t)
+{
+  int64_t *grown;
+  long i;
+
+  if (nwaiting == waitsize) {
+    grown = malloc((waitsize > 0 ? 2 * waitsize : 1024) * sizeof(int64_t));
+    if (grown == NULL) {
+      printf("memory allocation for message times failed.");
+      exit(EXIT_FAILURE);
     }
- 
-  /* create future event for when timer goes off */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
+    for (i=0; i<nwaiting; i++)
+      grown[i] = waiting[(waitfirst + i) % waitsize];
+    free(waiting);
+    waiting = grown;
+    waitsize = waitsize > 0 ? 2 * waitsize : 1024;
+    waitfirst = 0;
   }
-  evptr->evtime =  time + increment;
-  evptr->evtype =  TIMER_INTERRUPT;
-   
- 
-  evptr->eventity = AorB;
-  insertevent(evptr);
-} 
+  waiting[(waitfirst + nwaiting++) % waitsize] = t;
+}
+
+static int delaybucket(uint64_t v)
+{
+  int e = 0;
+
+  while ((v >> e) >= (2UL << DELAYSUB))
+    e++;
+  if (v < (1UL << DELAYSUB))
+    return (int)v;
+  return ((e + 1) << DELAYSUB) + (int)((v >> e) - (1UL << DELAYSUB));
+}
+
+/* the middle of bucket b, in ticks */
+static double bucketmiddle(int b)
+{
+  int e = (b >> DELAYSUB) - 1;
+
+  if (e < 0)
+    return b;
+  return ((double)((b & ((1 << DELAYSUB) - 1)) + (1 << DELAYSUB)) + 0.5) * ((uint64_t)1 << e);
+}
+
+/* the oldest message in transit has reached B's layer 5 now */
+static void messagedelivered(int64_t t)
+{
+  int64_t delay;
+
+  if (nwaiting == 0)
+    return;
+  delay = t - waiting[waitfirst];
+  waitfirst = (waitfirst + 1) % waitsize;
+  nwaiting--;
+  delayhist[delaybucket((uint64_t)delay)]++;
+  ndelays++;
+  delaysum += delay;
+  if (delay > delaymax)
+    delaymax = delay;
+}
+
+/* the delay, in time units, that fraction of the messages do not exceed */
+static double delaypercentile(double fraction)
+{
+  long seen = 0;
+  int b;
 
+  for (b=0; b<DELAYBUCKETS; b++)
+    if ((seen += delayhist[b]) >= fraction * ndelays && delayhist[b] > 0)
+      break;
+  if (b == DELAYBUCKETS || bucketmiddle(b) > delaymax)
+    return tounits(delaymax);
+  return tounits((int64_t)bucketmiddle(b));
+}
 
 /************************** TOLAYER3 ***************/
-void tolayer3(int AorB, struct pkt packet)
-/* A or B is sending to network  */
+void tolayer3ref(int AorB, const struct pkt *packet)
+/* A or B is sending to network, emulator keeps a reference to packet */
 {
-  struct pkt *mypktptr;
+  const struct pkt *mypktptr;
+  struct pkt *copy;
   struct event *evptr,*q;
-  float lastime, x;
+  int64_t lastime;
+  double x;
   int i;
 
+  PROFENTER(PROF_TOLAYER3);
   ntolayer3++;
 
   /* simulate losses: */
@@ -310,60 +728,52 @@ void tolayer3(int AorB, struct pkt packet)
     nlost++;
     if (TRACE>0)    
       printf("          TOLAYER3: packet being lost\n");
+    PROFEXIT();
     return;
   }  
 
-  /* make a copy of the packet student just gave me since he/she may decide */
-  /* to do something with the packet after we return back to him/her */ 
-  mypktptr = malloc(sizeof(struct pkt));
-  if (mypktptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
-  mypktptr->seqnum = packet.seqnum;
-  mypktptr->acknum = packet.acknum;
-  mypktptr->checksum = packet.checksum;
-  for (i=0; i<20; i++)
-    mypktptr->payload[i] = packet.payload[i];
+  /* hold a reference rather than copying; the sender may keep the packet */
+  /* for a retransmission, so corruption below works on a private copy    */
+  mypktptr = holdpkt(packet);
   if (TRACE>2)  {
     printf("          TOLAYER3: seq: %d, ack %d, check: %d ", mypktptr->seqnum,
            mypktptr->acknum,  mypktptr->checksum);
-    for (i=0; i<20; i++)
+    for (i=0; i<mypktptr->length; i++)
       printf("%c",mypktptr->payload[i]);
     printf("\n");
   }
 
   /* create future event for arrival of packet at the other side */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
+  evptr = newevent();
   evptr->evtype =  FROM_LAYER3;   /* packet will pop out from layer3 */
   evptr->eventity = (AorB+1) % 2; /* event occurs at other entity */
-  evptr->pktptr = mypktptr;       /* save ptr to my copy of packet */
+  evptr->pktptr = mypktptr;       /* save ptr to the packet */
   /* finally, compute the arrival time of packet at the other end.
      medium can not reorder, so make sure packet arrives between 1 and 10
      time units after the latest arrival time of packets
      currently in the medium on their way to the destination */
-  lastime = time;
+  lastime = now;
   /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next) */
   for (q=evlist; q!=NULL ; q = q->next) 
     if ( (q->evtype==FROM_LAYER3  && q->eventity==evptr->eventity) ) 
       lastime = q->evtime;
-  evptr->evtime =  lastime + 1 + 9*jimsrand();
+  evptr->evtime =  lastime + toticks(1 + 9*jimsrand());
  
 
 
   /* simulate corruption: */
   if ((jimsrand() < corruptprob)  && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
     ncorrupt++;
-    if ( (x = jimsrand()) < .75)
-      mypktptr->payload[0]='Z';   /* corrupt payload */
+    copy = newpkt();
+    *copy = *mypktptr;
+    releasepkt(mypktptr);
+    evptr->pktptr = copy;
+    if ( (x = jimsrand()) < .75 && copy->length > 0)
+      copy->payload[0]='Z';   /* corrupt payload */
     else if (x < .875)
-      mypktptr->seqnum = 999999;
+      copy->seqnum = 999999;
     else
-      mypktptr->acknum = 999999;
+      copy->acknum = 999999;
     if (TRACE>0)    
       printf("          TOLAYER3: packet being corrupted\n");
   }  
@@ -371,94 +781,838 @@ void tolayer3(int AorB, struct pkt packet)
   if (TRACE>2)  
     printf("          TOLAYER3: scheduling arrival on other side\n");
   insertevent(evptr);
+  PROFEXIT();
 } 
 
-void tolayer5(int AorB, char datasent[20])
+/* hand one message to the application at A or B */
+void deliver(int AorB, const struct pkt *packet, const char *datasent, int length)
 {
   int i;  
+
+  PROFENTER(PROF_TOLAYER5);
   if (TRACE>2) {
     printf("          TOLAYER5: data received by application at ");
     if (AorB == A) 
       printf("A: ");
     else
       printf("B: ");
-    for (i=0; i<20; i++)  
+    for (i=0; i<length; i++)  
       printf("%c",datasent[i]);
     printf("\n");
   }
   messages_delivered++;
+  bytes_delivered += length;
+  if (AorB == B) {
+    messagedelivered(now);
+    sinkmessage(packet, datasent, length);
+  }
+  PROFEXIT();
 }
 
-int main(void)
+/************************** SNAPSHOTS **************/
+/* 64-bit values are saved as two halves, as long may have only 32 bits */
+static void save64(FILE *f, uint64_t v)
+{
+  saveint(f, (long)(v >> 32));
+  saveint(f, (long)(v & 0xffffffffUL));
+}
+
+static uint64_t load64(FILE *f)
+{
+  uint64_t hi = (uint32_t)loadint(f);
+
+  return hi << 32 | (uint32_t)loadint(f);
+}
+
+static void savestring(FILE *f, const char *s)
+{
+  saveint(f, (long)strlen(s));
+  fputs(s, f);
+}
+
+static char *loadstring(FILE *f)
+{
+  long len = loadint(f);
+  char *s;
+
+  if (len < 0 || len > FILENAME_MAX || (s = malloc(len + 1)) == NULL
+      || fread(s, 1, len, f) != (size_t)len) {
+    printf("snapshot is truncated or damaged\n");
+    exit(EXIT_FAILURE);
+  }
+  s[len] = '\0';
+  return s;
+}
+
+/* the messages in transit and the delay histogram */
+static void savedelays(FILE *f)
+{
+  long i;
+  int b, n = 0;
+
+  saveint(f, nwaiting);
+  for (i=0; i<nwaiting; i++)
+    save64(f, (uint64_t)waiting[(waitfirst + i) % waitsize]);
+  for (b=0; b<DELAYBUCKETS; b++)
+    n += delayhist[b] > 0;
+  saveint(f, n);
+  for (b=0; b<DELAYBUCKETS; b++)
+    if (delayhist[b] > 0) {
+      saveint(f, b);
+      saveint(f, delayhist[b]);
+    }
+  saveint(f, ndelays);
+  savedouble(f, delaysum);
+  save64(f, (uint64_t)delaymax);
+}
+
+static void loaddelays(FILE *f)
+{
+  long i, n;
+  int b;
+
+  resetdelays();
+  for (n=loadint(f), i=0; i<n; i++)
+    messagesent((int64_t)load64(f));
+  for (n=loadint(f); n>0; n--) {
+    b = (int)loadint(f);
+    if (b < 0 || b >= DELAYBUCKETS) {
+      printf("snapshot is truncated or damaged\n");
+      exit(EXIT_FAILURE);
+    }
+    delayhist[b] = loadint(f);
+  }
+  ndelays = loadint(f);
+  delaysum = loaddouble(f);
+  delaymax = (int64_t)load64(f);
+}
+
+/* write the whole state of the run, between two events, to snappath. */
+/* It goes to a temporary file first so a crash leaves the last one.  */
+static void savesnapshot(void)
+{
+  struct event *q;
+  struct timer *t;
+  char *tmp;
+  FILE *f;
+  long n;
+  int i;
+
+  tmp = malloc(strlen(snappath) + 5);
+  if (tmp == NULL) {
+    printf("memory allocation for snapshot failed.");
+    exit(EXIT_FAILURE);
+  }
+  strcat(strcpy(tmp, snappath), ".tmp");
+  if ((f = fopen(tmp, "wb")) == NULL) {
+    printf("cannot write snapshot %s\n", tmp);
+    exit(EXIT_FAILURE);
+  }
+  fputs(SNAPMAGIC, f);
+  savestring(f, proto->name);
+  savestring(f, arrivalspec);
+  saveint(f, mtu);
+  savedouble(f, flushdelay);
+  saveint(f, fecgroup);
+  saveint(f, window);
+  saveint(f, seqspace);
+  saveint(f, recvbuffer);
+  saveint(f, advertise);
+  savedouble(f, lossprob);
+  savedouble(f, corruptprob);
+  saveint(f, corruptdirection);
+  savedouble(f, lambda);
+  saveint(f, nsimmax);
+
+  save64(f, (uint64_t)now);
+  save64(f, nextevseq);
+  saveint(f, nsim);
+  save64(f, (uint64_t)lastarrival);
+  for (i=0; i<RNGDEG; i++)
+    save64(f, rngstate[i]);
+  saveint(f, rngfront);
+  saveint(f, rngrear);
+  for (i=0; i<(int)NCOUNTERS; i++)
+    saveint(f, *counters[i].value);
+  for (i=0; i<4; i++) {
+    t = &timers[i / 2][i % 2];
+    saveint(f, t->running);
+    save64(f, (uint64_t)t->deadline);
+    save64(f, t->seq);
+    saveint(f, t->gen);
+    save64(f, (uint64_t)t->pending);
+  }
+  for (n=0, q=evlist; q!=NULL; q=q->next)
+    n++;
+  saveint(f, n);
+  for (q=evlist; q!=NULL; q=q->next) {
+    save64(f, (uint64_t)q->evtime);
+    save64(f, q->evseq);
+    saveint(f, q->evgen);
+    saveint(f, q->evtype);
+    saveint(f, q->eventity);
+    if (q->evtype == FROM_LAYER3)
+      savepkt(f, q->pktptr);
+  }
+  savedelays(f);
+  savearrivals(f);
+  saveapp(f);
+  proto->save(f);
+
+  if (ferror(f) || fclose(f) != 0 || rename(tmp, snappath) != 0) {
+    printf("cannot write snapshot %s\n", snappath);
+    exit(EXIT_FAILURE);
+  }
+  free(tmp);
+  if (TRACE>1)
+    printf("          SNAPSHOT: saved to %s after %ld events\n", snappath, nevents);
+}
+
+/* read the protocol and settings of the run saved in a snapshot */
+static void loadsettings(FILE *f)
+{
+  char magic[sizeof(SNAPMAGIC)];
+  char *name;
+
+  if (fread(magic, 1, strlen(SNAPMAGIC), f) != strlen(SNAPMAGIC)
+      || memcmp(magic, SNAPMAGIC, strlen(SNAPMAGIC)) != 0) {
+    printf("not a snapshot of this simulator\n");
+    exit(EXIT_FAILURE);
+  }
+  name = loadstring(f);
+  if ((runs[0] = findprotocol(name)) == NULL) {
+    printf("snapshot is of unknown protocol %s\n", name);
+    exit(EXIT_FAILURE);
+  }
+  nruns = 1;
+  free(name);
+  arrivalspec = loadstring(f);
+  mtu = loadint(f);
+  flushdelay = loaddouble(f);
+  fecgroup = loadint(f);
+  window = loadint(f);
+  seqspace = loadint(f);
+  recvbuffer = loadint(f);
+  advertise = loadint(f);
+  lossprob = loaddouble(f);
+  corruptprob = loaddouble(f);
+  corruptdirection = loadint(f);
+  lambda = loaddouble(f);
+  nsimmax = loadint(f);
+}
+
+/* read back the rest of what savesnapshot() wrote, in place of init() */
+static void loadstate(FILE *f)
+{
+  struct event *evptr, *last = NULL;
+  struct timer *t;
+  long n;
+  int i;
+
+  now = (int64_t)load64(f);
+  nextevseq = load64(f);
+  nsim = loadint(f);
+  lastarrival = (int64_t)load64(f);
+  for (i=0; i<RNGDEG; i++)
+    rngstate[i] = (uint32_t)load64(f);
+  rngfront = loadint(f);
+  rngrear = loadint(f);
+  if (rngfront < 0 || rngfront >= RNGDEG || rngrear < 0 || rngrear >= RNGDEG) {
+    printf("snapshot is truncated or damaged\n");
+    exit(EXIT_FAILURE);
+  }
+  for (i=0; i<(int)NCOUNTERS; i++)
+    *counters[i].value = loadint(f);
+  for (i=0; i<4; i++) {
+    t = &timers[i / 2][i % 2];
+    t->running = loadint(f);
+    t->deadline = (int64_t)load64(f);
+    t->seq = load64(f);
+    t->gen = (uint32_t)loadint(f);
+    t->pending = (int64_t)load64(f);
+  }
+  /* the events were saved in list order, so they are appended as read */
+  evlist = NULL;
+  for (n=loadint(f); n>0; n--) {
+    evptr = newevent();
+    evptr->evtime = (int64_t)load64(f);
+    evptr->evseq = load64(f);
+    evptr->evgen = (uint32_t)loadint(f);
+    evptr->evtype = loadint(f);
+    evptr->eventity = loadint(f);
+    evptr->pktptr = evptr->evtype == FROM_LAYER3 ? loadpkt(f) : NULL;
+    evptr->next = NULL;
+    evptr->prev = last;
+    if (last == NULL)
+      evlist = evptr;
+    else
+      last->next = evptr;
+    last = evptr;
+    PROFLENGTH(1);
+  }
+  loaddelays(f);
+  loadarrivals(f);
+  loadapp(f);
+  proto->restore(f);
+  if (getc(f) != EOF) {
+    printf("snapshot is truncated or damaged\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/************************** PROFILER ***************/
+/* Built with -DPROFILE, the hooks above time each dispatch branch and  */
+/* the emulator routines the engines call, building a call tree: a site */
+/* entered from two different places gets two nodes, so self time can  */
+/* be told apart from time spent in the routines a site calls.  Ticks  */
+/* are the TSC where there is one and nanoseconds otherwise, converted */
+/* to nanoseconds for the report.  The length of the event list is     */
+/* sampled before every event.                                          */
+#ifdef PROFILE
+#define  PROFNODES  256   /* distinct call paths */
+#define  PROFDEPTH  16    /* deepest nesting of sites */
+
+static FILE *stacksfile = NULL;   /* -F: collapsed stacks for a flame graph */
+
+static const char *const sitenames[PROF_SITES] = {
+  "eventloop", "FROM_LAYER5", "FROM_LAYER3", "TIMER_INTERRUPT", "FLUSH_TIMER",
+  "insertevent", "tolayer3", "tolayer5", "starttimer", "stoptimer",
+  "startflushtimer", "stopflushtimer"
+};
+
+struct profnode {
+  int site;
+  int parent, child, sibling;   /* -1 for none */
+  long calls;
+  uint64_t ticks;               /* including the sites it calls */
+};
+
+static struct profnode profnodes[PROFNODES];
+static int nprofnodes;
+static int profiling;             /* a run is being timed */
+static int profcurrent;           /* node being timed */
+static uint64_t profstarted[PROFDEPTH];
+static int profdepth;
+static long *lenhist;             /* events seen with each list length */
+static long lenhistsize;
+static double startns;            /* clock and ticks when the run started */
+static uint64_t startticks;
+
+static double nsclock(void);
+
+static uint64_t proftick(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#else
+  return (uint64_t)nsclock();
+#endif
+}
+
+static int profnewnode(int site, int parent)
+{
+  struct profnode *n = &profnodes[nprofnodes];
+
+  if (nprofnodes == PROFNODES) {
+    printf("profiler: more than %d call paths\n", PROFNODES);
+    exit(EXIT_FAILURE);
+  }
+  n->site = site;
+  n->parent = parent;
+  n->child = -1;
+  n->sibling = parent >= 0 ? profnodes[parent].child : -1;
+  n->calls = 0;
+  n->ticks = 0;
+  if (parent >= 0)
+    profnodes[parent].child = nprofnodes;
+  return nprofnodes++;
+}
+
+static void profenter(int site)
+{
+  int n;
+
+  if (!profiling)
+    return;
+  for (n=profnodes[profcurrent].child; n>=0 && profnodes[n].site!=site; n=profnodes[n].sibling)
+    ;
+  if (n < 0)
+    n = profnewnode(site, profcurrent);
+  if (profdepth == PROFDEPTH) {
+    printf("profiler: sites nested more than %d deep\n", PROFDEPTH);
+    exit(EXIT_FAILURE);
+  }
+  profcurrent = n;
+  profstarted[profdepth++] = proftick();
+}
+
+static void profexit(void)
+{
+  struct profnode *n = &profnodes[profcurrent];
+
+  if (!profiling)
+    return;
+  n->ticks += proftick() - profstarted[--profdepth];
+  n->calls++;
+  profcurrent = n->parent >= 0 ? n->parent : 0;
+  profiling = profdepth > 0;      /* until the run itself ends */
+}
+
+/* start the call tree afresh with the run as its root; the hooks do */
+/* nothing outside a run                                            */
+static void profstart(void)
+{
+  long i;
+
+  nprofnodes = 0;
+  profdepth = 0;
+  profcurrent = profnewnode(PROF_RUN, -1);
+  for (i=0; i<lenhistsize; i++)
+    lenhist[i] = 0;
+  startns = nsclock();
+  startticks = proftick();
+  profstarted[profdepth++] = startticks;
+  profiling = 1;
+}
+
+/* count the current length of the event list */
+static void proflength(void)
+{
+  long newsize;
+
+  if (evlength >= lenhistsize) {
+    newsize = lenhistsize > 0 ? lenhistsize : 1024;
+    while (newsize <= evlength)
+      newsize *= 2;
+    if ((lenhist = realloc(lenhist, newsize * sizeof(long))) == NULL) {
+      printf("profiler: no memory for the event list lengths\n");
+      exit(EXIT_FAILURE);
+    }
+    memset(lenhist + lenhistsize, 0, (newsize - lenhistsize) * sizeof(long));
+    lenhistsize = newsize;
+  }
+  lenhist[evlength]++;
+}
+
+/* the shortest length at least fraction of the samples do not exceed */
+static long percentile(long samples, double fraction)
+{
+  long i, seen = 0;
+
+  for (i=0; i<lenhistsize; i++)
+    if ((seen += lenhist[i]) >= fraction * samples)
+      return i;
+  return lenhistsize - 1;
+}
+
+/* ticks of node n not spent in the sites it calls */
+static uint64_t selfticks(int n)
+{
+  uint64_t self = profnodes[n].ticks;
+  int c;
+
+  for (c=profnodes[n].child; c>=0; c=profnodes[c].sibling)
+    self -= profnodes[c].ticks;
+  return self;
+}
+
+/* one line per call path, root first: "gbn;FROM_LAYER3;tolayer3 <self ns>" */
+static void writestack(int n, double nspertick)
+{
+  const char *path[PROFDEPTH + 1];
+  int depth = 0, m, c;
+
+  for (m=n; m>=0; m=profnodes[m].parent)
+    path[depth++] = m > 0 ? sitenames[profnodes[m].site] : proto->name;
+  while (depth > 0) {
+    depth--;
+    fprintf(stacksfile, "%s%s", path[depth], depth > 0 ? ";" : "");
+  }
+  fprintf(stacksfile, " %.0f\n", selfticks(n) * nspertick);
+  for (c=profnodes[n].child; c>=0; c=profnodes[c].sibling)
+    writestack(c, nspertick);
+}
+
+static void profreport(void)
+{
+  long calls[PROF_SITES], samples = 0, i;
+  uint64_t total[PROF_SITES], self[PROF_SITES];
+  double nspertick, runns, sum = 0.0;
+  int n, s;
+
+  nspertick = (nsclock() - startns) / (proftick() - startticks);
+  runns = profnodes[0].ticks * nspertick;
+  for (s=0; s<PROF_SITES; s++) {
+    calls[s] = 0;
+    total[s] = self[s] = 0;
+  }
+  /* no site calls another of its own kind, so the totals can be summed */
+  for (n=0; n<nprofnodes; n++) {
+    calls[profnodes[n].site] += profnodes[n].calls;
+    total[profnodes[n].site] += profnodes[n].ticks;
+    self[profnodes[n].site] += selfticks(n);
+  }
+  printf("profile: %.0f ns in the event loop, %f ns per tick\n", runns, nspertick);
+  printf("  %-16s %10s %12s %12s %10s %7s\n", "site", "calls", "total ns", "self ns", "ns/call", "self %");
+  for (s=0; s<PROF_SITES; s++)
+    if (calls[s] > 0)
+      printf("  %-16s %10ld %12.0f %12.0f %10.1f %6.1f%%\n", sitenames[s], calls[s],
+             total[s] * nspertick, self[s] * nspertick, total[s] * nspertick / calls[s],
+             runns > 0.0 ? 100.0 * self[s] * nspertick / runns : 0.0);
+
+  for (i=0; i<lenhistsize; i++) {
+    samples += lenhist[i];
+    sum += (double)i * lenhist[i];
+  }
+  if (samples > 0)
+    printf("event list length: mean %.1f, p50 %ld, p90 %ld, p99 %ld, p99.9 %ld, max %ld\n",
+           sum / samples, percentile(samples, 0.5), percentile(samples, 0.9),
+           percentile(samples, 0.99), percentile(samples, 0.999), percentile(samples, 1.0));
+  if (stacksfile != NULL) {
+    writestack(0, nspertick);
+    fflush(stacksfile);
+  }
+}
+#endif
+
+/* create the collapsed stack file -F names */
+static void openstacks(const char *path)
+{
+#ifdef PROFILE
+  if ((stacksfile = fopen(path, "w")) == NULL) {
+    printf("cannot create %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+#else
+  printf("-F needs the profiler: build with -DPROFILE (make rdt-prof)\n");
+  exit(EXIT_FAILURE);
+#endif
+}
+
+/************************** STATISTICS EXPORT ******/
+/* -x writes the counters of every run for sweep tooling to parse: as  */
+/* CSV if the file name ends in .csv, one row per record, and as JSON  */
+/* otherwise, an array holding an object per run.  A run's final       */
+/* counters are its "end" record; with -T it is preceded by a "sample" */
+/* record every T time units.  Counters are cumulative, so rates are   */
+/* the differences between records.                                    */
+static FILE *exportfile = NULL;
+static const char *exportpath;
+static int exportcsv;             /* CSV rather than JSON */
+static int exportruns;            /* runs written so far */
+static int exportrecords;         /* records written for this run */
+static double sampleevery = 0.0;  /* -T: time units between samples */
+static int64_t sampleticks;
+static int64_t nextsample;        /* time of the next sample */
+
+static void exportfailed(void)
+{
+  printf("cannot write statistics to %s\n", exportpath);
+  exit(EXIT_FAILURE);
+}
+
+static void openexport(const char *path)
+{
+  size_t len = strlen(path);
+  int i;
+
+  if ((exportfile = fopen(path, "w")) == NULL) {
+    printf("cannot create %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+  exportpath = path;
+  exportcsv = len >= 4 && strcmp(path + len - 4, ".csv") == 0;
+  if (exportcsv) {
+    fprintf(exportfile, "protocol,record,time,messages_sent");
+    for (i=0; i<(int)NCOUNTERS; i++)
+      fprintf(exportfile, ",%s", counters[i].name);
+    fprintf(exportfile, ",inflight\n");
+  }
+  else
+    fprintf(exportfile, "[");
+}
+
+/* begin the records of a run; the first sample falls on the next */
+/* multiple of T, which keeps a resumed run's samples in step     */
+static void startexport(void)
+{
+  if (exportfile == NULL)
+    return;
+  exportrecords = 0;
+  if (sampleevery > 0.0) {
+    sampleticks = toticks(sampleevery);
+    if (sampleticks < 1)
+      sampleticks = 1;
+    nextsample = (now / sampleticks + 1) * sampleticks;
+  }
+  if (exportcsv)
+    return;
+  fprintf(exportfile, "%s\n  {\"protocol\": \"%s\",\n", exportruns > 0 ? "," : "", proto->name);
+  fprintf(exportfile, "   \"settings\": {\"messages\": %ld, \"loss\": %.10g, \"corruption\": %.10g, "
+          "\"direction\": %d, \"lambda\": %.10g, \"arrivals\": \"%s\", "
+          "\"mtu\": %d, \"flushdelay\": %.10g, \"fecgroup\": %d, \"window\": %d, \"seqspace\": %d, "
+          "\"recvbuffer\": %ld, \"recvpolicy\": \"%s\", \"sample_interval\": %.10g},\n",
+          nsimmax, lossprob, corruptprob, corruptdirection, lambda, arrivals->name,
+          mtu, flushdelay, fecgroup, window, seqspace,
+          recvbuffer, advertise ? "advertise" : "drop", sampleevery);
+  fprintf(exportfile, "   \"samples\": [");
+}
+
+/* the counters as they stand, recorded as of time t */
+static void exportrecord(const char *record, int64_t t)
+{
+  int i;
+
+  if (exportcsv) {
+    fprintf(exportfile, "%s,%s,%.6f,%ld", proto->name, record, tounits(t), nsim);
+    for (i=0; i<(int)NCOUNTERS; i++)
+      fprintf(exportfile, ",%ld", *counters[i].value);
+    fprintf(exportfile, ",%d\n", proto->inflight());
+  }
+  else {
+    if (strcmp(record, "end") == 0)
+      fprintf(exportfile, "],\n   \"end\": ");
+    else
+      fprintf(exportfile, "%s\n    ", exportrecords > 0 ? "," : "");
+    fprintf(exportfile, "{\"time\": %.6f, \"messages_sent\": %ld", tounits(t), nsim);
+    for (i=0; i<(int)NCOUNTERS; i++)
+      fprintf(exportfile, ", \"%s\": %ld", counters[i].name, *counters[i].value);
+    fprintf(exportfile, ", \"inflight\": %d}", proto->inflight());
+  }
+  exportrecords++;
+}
+
+static void finishexport(void)
+{
+  if (exportfile == NULL)
+    return;
+  exportrecord("end", now);
+  if (!exportcsv)
+    fprintf(exportfile, "}");
+  exportruns++;
+  if (fflush(exportfile) != 0)
+    exportfailed();
+}
+
+static void closeexport(void)
+{
+  if (exportfile == NULL)
+    return;
+  if (!exportcsv)
+    fprintf(exportfile, "\n]\n");
+  if (fclose(exportfile) != 0)
+    exportfailed();
+  exportfile = NULL;
+}
+
+/* add the engines named in a comma separated list to the runs */
+static void selectprotocols(char *list)
+{
+  char *name;
+  int i, found;
+
+  for (name = strtok(list, ","); name != NULL; name = strtok(NULL, ",")) {
+    found = 0;
+    for (i=0; engines[i]!=NULL; i++)
+      if (strcmp(name, "all") == 0 || strcmp(name, engines[i]->name) == 0) {
+        if (nruns == MAXRUNS) {
+          printf("at most %d protocol runs may be chosen\n", MAXRUNS);
+          exit(EXIT_FAILURE);
+        }
+        runs[nruns++] = engines[i];
+        found = 1;
+      }
+    if (!found) {
+      printf("unknown protocol %s\n", name);
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+/* read the optional command line settings */
+static void parseargs(int argc, char **argv)
+{
+  int i;
+
+  for (i=1; i<argc; i++) {
+    if (settingarg(argc, argv, &i))
+      continue;
+    else if (strcmp(argv[i], "-p") == 0 && i+1 < argc)
+      selectprotocols(argv[++i]);
+    else if (strcmp(argv[i], "-i") == 0 && i+1 < argc)
+      sourcepath = argv[++i];
+    else if (strcmp(argv[i], "-o") == 0 && i+1 < argc)
+      opensink(argv[++i]);
+    else if (strcmp(argv[i], "-a") == 0 && i+1 < argc)
+      arrivalspec = argv[++i];
+    else if (strcmp(argv[i], "-S") == 0 && i+1 < argc)
+      snappath = argv[++i];
+    else if (strcmp(argv[i], "-N") == 0 && i+1 < argc)
+      snapevery = atol(argv[++i]);
+    else if (strcmp(argv[i], "-M") == 0)
+      microbench = 1;
+    else if (strcmp(argv[i], "-F") == 0 && i+1 < argc)
+      openstacks(argv[++i]);
+    else if (strcmp(argv[i], "-x") == 0 && i+1 < argc)
+      openexport(argv[++i]);
+    else if (strcmp(argv[i], "-T") == 0 && i+1 < argc)
+      sampleevery = atof(argv[++i]);
+    else if (strcmp(argv[i], "-s") == 0 && i+1 < argc)
+      seed = atol(argv[++i]);
+    else if (strcmp(argv[i], "-R") == 0 && i+1 < argc) {
+      if ((resumefrom = fopen(argv[++i], "rb")) == NULL) {
+        printf("cannot read snapshot %s\n", argv[i]);
+        exit(EXIT_FAILURE);
+      }
+    }
+    else {
+      printf("usage: %s [-p gbn|sr|all[,...]] [-i infile] [-o outfile]\n"
+             "          [-a uniform|poisson|onoff|mmpp|trace:file]\n"
+             "          [-S snapshot] [-N events between snapshots] [-R snapshot to resume]\n"
+             "          [-x stats.json|stats.csv] [-T sample interval] [-s seed]\n"
+             "          [-M] [-F stacks (with -DPROFILE)] %s\n", argv[0], SETTINGSUSAGE);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (resumefrom != NULL && nruns > 0) {
+    printf("a resumed run uses the protocol saved in its snapshot, -p cannot be given\n");
+    exit(EXIT_FAILURE);
+  }
+  if (sampleevery < 0.0 || (sampleevery > 0.0 && exportfile == NULL)) {
+    printf("-T needs a positive interval and a file to write the samples to (-x)\n");
+    exit(EXIT_FAILURE);
+  }
+  if (nruns == 0)
+    runs[nruns++] = engines[0];
+  checksettings();
+}
+
+/* run one simulation with the given protocol engine and report on it */
+void simulate(const struct protocol *p)
 {
   struct event *eventptr;
   struct msg  msg2give;
-  struct pkt  pkt2give;
+  long accepted;
    
   int i,j;
   
-  init();
-  A_init();
-  B_init();
+  proto = p;
+  if (resumefrom != NULL) {
+    proto->A_init();
+    proto->B_init();
+    loadstate(resumefrom);
+    fclose(resumefrom);
+    resumefrom = NULL;
+  }
+  else {
+    init();
+    startapp();
+    proto->A_init();
+    proto->B_init();
+  }
+  startexport();
+#ifdef PROFILE
+  profstart();
+#endif
    
   while (1) {
-    eventptr = evlist;            /* get next event to simulate */
+    eventptr = nextevent();       /* get next event to simulate */
     if (eventptr==NULL)
       goto terminate;
+    if (snapevery > 0 && nevents > 0 && nevents % snapevery == 0)
+      savesnapshot();             /* before the event, so it is redone on resume */
+#ifdef PROFILE
+    proflength();
+#endif
     evlist = evlist->next;        /* remove this event from event list */
     if (evlist!=NULL)
       evlist->prev=NULL;
+    PROFLENGTH(-1);
+    while (exportfile != NULL && sampleticks > 0 && eventptr->evtime >= nextsample) {
+      exportrecord("sample", nextsample);  /* as things stood at that time */
+      nextsample += sampleticks;
+    }
     if (TRACE>=2) {
-      printf("\nEVENT time: %f,",eventptr->evtime);
+      printf("\nEVENT time: %f,",tounits(eventptr->evtime));
       printf("  type: %d",eventptr->evtype);
       if (eventptr->evtype==0)
         printf(", timerinterrupt  ");
       else if (eventptr->evtype==1)
         printf(", fromlayer5 ");
+      else if (eventptr->evtype==3)
+        printf(", flushtimer ");
       else
         printf(", fromlayer3 ");
       printf(" entity: %d\n",eventptr->eventity);
     }
-    time = eventptr->evtime;        /* update time to next event time */
+    now = eventptr->evtime;         /* update time to next event time */
+    nevents++;
     if (eventptr->evtype == FROM_LAYER5 ) {
-      if (nsim < nsimmax) {
+      PROFENTER(PROF_FROM_LAYER5);
+      if (nsim < nsimmax && (sourcepath == NULL || sourceleft())) {
         generate_next_arrival();   /* set up future arrival */
-        /* fill in msg to give with string of same letter */    
-        j = nsim % 26; 
-        for (i=0; i<20; i++)  
-          msg2give.data[i] = 97 + j;
+        if (sourcepath != NULL)
+          nextmessage(&msg2give);
+        else {
+          /* fill in msg to give with string of same letter */    
+          j = nsim % 26; 
+          for (i=0; i<MSGSIZE; i++)  
+            msg2give.data[i] = 97 + j;
+        }
         if (TRACE>2) {
           printf("          MAINLOOP: data given to student: ");
-          for (i=0; i<20; i++) 
+          for (i=0; i<MSGSIZE; i++) 
             printf("%c", msg2give.data[i]);
           printf("\n");
         }
         nsim++;
-        if (eventptr->eventity == A) 
-          A_output(msg2give);  
-        else
-          B_output(msg2give);  
+        lastarrival = now;
+        if (eventptr->eventity == A) {
+          accepted = window_full;
+          proto->A_output(&msg2give);  
+          if (window_full == accepted) {
+            messagesent(now);
+            if (sourcepath != NULL)
+              acceptmessage();
+          }
+        }
+        else {
+          proto->B_output(&msg2give);  
+          if (sourcepath != NULL)
+            acceptmessage();
+        }
       }
       else if (TRACE > 2)
           printf("          FROM_LAYER5: no more messages to send: \n");
+      PROFEXIT();
     }
     else if (eventptr->evtype ==  FROM_LAYER3) {
-      pkt2give.seqnum = eventptr->pktptr->seqnum;
-      pkt2give.acknum = eventptr->pktptr->acknum;
-      pkt2give.checksum = eventptr->pktptr->checksum;
-      for (i=0; i<20; i++)  
-        pkt2give.payload[i] = eventptr->pktptr->payload[i];
-	    if (eventptr->eventity ==A)      /* deliver packet by calling */
-        A_input(pkt2give);            /* appropriate entity */
+      PROFENTER(PROF_FROM_LAYER3);
+      if (eventptr->eventity ==A)      /* deliver packet by calling */
+        proto->A_input(eventptr->pktptr);  /* appropriate entity */
       else
-        B_input(pkt2give);
-	    free(eventptr->pktptr);          /* free the memory for packet */
+        proto->B_input(eventptr->pktptr);
+      releasepkt(eventptr->pktptr);    /* drop the event's reference */
+      PROFEXIT();
     }
     else if (eventptr->evtype ==  TIMER_INTERRUPT) {
+      PROFENTER(PROF_TIMER);
+      timerfired(eventptr);
+      packets_timeout++;
       if (eventptr->eventity == A) 
-        A_timerinterrupt();
+        proto->A_timerinterrupt();
       else
-        B_timerinterrupt();
+        proto->B_timerinterrupt();
+      PROFEXIT();
+    }
+    else if (eventptr->evtype ==  FLUSH_TIMER) {
+      PROFENTER(PROF_FLUSH);
+      timerfired(eventptr);
+      if (eventptr->eventity == A) 
+        proto->A_flushinterrupt();
+      else
+        proto->B_flushinterrupt();
+      PROFEXIT();
     }
     else  {
       printf("INTERNAL PANIC: unknown event type \n");
@@ -467,12 +1621,325 @@ int main(void)
   }
 
  terminate:
-  printf(" Simulator terminated at time %f\n after attempting to send %d msgs from layer5\n",time,nsim);
-  printf("number of messages dropped due to full window:  %d \n", window_full);
-  printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %d \n", new_ACKs);
+#ifdef PROFILE
+  profexit();                     /* the run */
+#endif
+  printf(" Protocol: %s\n", proto->name);
+  printf(" Simulator terminated at time %f\n after attempting to send %ld msgs from layer5\n",tounits(now),nsim);
+  if (strcmp(arrivals->name, "uniform") != 0 && nsim > 0)
+    printf("arrival process:  %s, mean time between messages %f\n",
+           arrivals->name, tounits(lastarrival) / nsim);
+  if (sourcepath != NULL)
+    printf("number of messages refused at a full window and offered again:  %ld \n", window_full);
+  else
+    printf("number of messages dropped due to full window:  %ld \n", window_full);
+  printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %ld \n", new_ACKs);
   printf("(note: a single acknowledgement may have acknowledged more than one packet - if cumulative acknowledgements are used)\n");
-  printf("number of packet resends by A:  %d \n", packets_resent);
-  printf("number of correct packets received at B:  %d \n", packets_received);
-  printf("number of messages delivered to application:  %d \n", messages_delivered);
+  printf("number of packet resends by A:  %ld \n", packets_resent);
+  printf("number of correct packets received at B:  %ld \n", packets_received);
+  printf("number of messages delivered to application:  %ld \n", messages_delivered);
+  printf("number of bytes delivered to application:  %ld \n", bytes_delivered);
+  if (fecgroup > 0) {
+    printf("number of FEC parity packets sent by A:  %ld \n", parity_sent);
+    printf("number of packets recovered by FEC at B:  %ld \n", packets_recovered);
+  }
+  if (recvbuffer > 0 && strcmp(proto->name, "sr") == 0)
+    printf("receive buffer:  at most %ld of %ld bytes held, %ld packets dropped for want of room\n",
+           recv_peak, recvbuffer, recv_dropped);
+  if (bytes_delivered > 0) {
+    printf("events simulated per delivered byte:  %f \n", (double)nevents/bytes_delivered);
+    printf("packets sent into layer 3 per delivered byte:  %f \n", (double)ntolayer3/bytes_delivered);
+  }
+  printf("packets sent into layer 3:  %ld, of which lost %ld and corrupted %ld\n",
+         ntolayer3, nlost, ncorrupt);
+  if (ndelays > 0)
+    printf("message delay:  mean %f, p50 %f, p90 %f, p99 %f, max %f\n",
+           tounits((int64_t)(delaysum / ndelays)), delaypercentile(0.5),
+           delaypercentile(0.9), delaypercentile(0.99), tounits(delaymax));
+  printf("number of events simulated:  %ld \n", nevents);
+  if (messages_delivered > 0)
+    printf("event list operations for timers:  %ld for %ld starts and stops, %f saved per delivered message\n",
+           ntimerops, ntimercalls, (double)(ntimercalls - ntimerops) / messages_delivered);
+  printf("memory allocations:  %ld events, %ld packet buffer blocks\n",
+         nevallocs, poolblocks - poolstart);
+#ifdef PROFILE
+  profreport();
+#endif
+  finishexport();
+  finishapp();
+}
+
+/************************** MICROBENCHMARKS ********/
+/* -M times the hot routines on their own: insertevent(), tolayer3ref() */
+/* and, for each engine chosen, its checksum and input handlers.  Each  */
+/* result is printed as "micro <name> <ns per call> <relative cost>"   */
+/* for bench.c.  The clock is read only around a batch of calls, never  */
+/* around one, so the cost of reading it is spread over the batch       */
+/* instead of estimated and taken off.  The relative cost divides by a  */
+/* fixed loop timed just after the routine, which takes out most of the */
+/* machine's speed from one moment (and one machine) to the next.       */
+#define  MICROOPS   1000000   /* calls timed per routine */
+#define  CALIBRATEOPS 10000000 /* steps of the calibration loop */
+#define  MICROLIST  16        /* events on the list while insertevent runs */
+#define  MICROBATCH 8         /* tolayer3ref calls between clearing the list */
+#define  MICROWINDOW 8        /* most packets an engine handles in one batch */
+
+static double nsclock(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* take the first event off the list */
+static struct event *popevent(void)
+{
+  struct event *q = evlist;
+
+  if (q != NULL) {
+    evlist = q->next;
+    if (evlist != NULL)
+      evlist->prev = NULL;
+  }
+  return q;
+}
+
+/* take the first packet in flight off the list, NULL if there is none */
+static const struct pkt *poppacket(void)
+{
+  struct event *q;
+  const struct pkt *packet;
+
+  for (q=evlist; q!=NULL && q->evtype!=FROM_LAYER3; q=q->next)
+    ;
+  if (q == NULL)
+    return NULL;
+  if (q->prev != NULL)
+    q->prev->next = q->next;
+  else
+    evlist = q->next;
+  if (q->next != NULL)
+    q->next->prev = q->prev;
+  packet = q->pktptr;
+  free(q);
+  return packet;
+}
+
+static void clearevents(void)
+{
+  struct event *q;
+
+  while ((q = popevent()) != NULL) {
+    if (q->evtype == FROM_LAYER3)
+      releasepkt(q->pktptr);
+    free(q);
+  }
+  resettimers();
+}
+
+static volatile unsigned long calibratesink;  /* keeps the loop from being optimized out */
+
+/* ns per step of a fixed integer loop: the unit of the relative costs */
+static double calibrate(void)
+{
+  unsigned long x = 1;
+  double t = nsclock();
+  long i;
+
+  for (i=0; i<CALIBRATEOPS; i++)
+    x = x * 1103515245UL + 12345UL;
+  calibratesink = x;
+  return (nsclock() - t) / CALIBRATEOPS;
+}
+
+/* ns taken by calls calls of routine */
+static void reportmicro(const char *name, const char *routine, double ns, long calls)
+{
+  printf("micro %s%s%s %f %f\n", name, *name ? "." : "", routine, ns / calls,
+         ns / calls / calibrate());
+}
+
+/* the classic hold model: take the earliest event and put it back later */
+static void microinsert(void)
+{
+  struct event *q;
+  double t;
+  long i;
+
+  for (i=0; i<MICROLIST; i++) {
+    q = newevent();
+    q->evtime = now + toticks(20 * jimsrand());
+    q->evtype = TIMER_INTERRUPT;
+    q->eventity = A;
+    insertevent(q);
+  }
+  t = nsclock();
+  for (i=0; i<MICROOPS; i++) {
+    q = popevent();
+    now = q->evtime;
+    q->evtime = now + toticks(20 * jimsrand());
+    insertevent(q);
+  }
+  reportmicro("", "insertevent", nsclock() - t, MICROOPS);
+  clearevents();
+}
+
+/* packets into a channel that loses and corrupts a tenth of them */
+static void microtolayer3(void)
+{
+  struct pkt *packet = newpkt();
+  double t, sum = 0.0;
+  long i, j;
+
+  memset(packet, 0, sizeof(*packet));
+  packet->length = MSGHDRSIZE + MSGSIZE;
+  lossprob = corruptprob = 0.1;
+  corruptdirection = 2;
+  for (i=0; i<MICROOPS; i+=MICROBATCH) {
+    clearevents();
+    t = nsclock();
+    for (j=0; j<MICROBATCH; j++)
+      tolayer3ref(A, packet);
+    sum += nsclock() - t;
+  }
+  reportmicro("", "tolayer3", sum, i);
+  clearevents();
+  releasepkt(packet);
+  lossprob = corruptprob = 0.0;
+}
+
+/* the engine's checksum over a full sized packet, through A_input of a */
+/* corrupted ACK; the whole transfer of a message (A_output, B_input    */
+/* and A_input with the emulator's work between them); B_input and     */
+/* A_input on their own, for as many messages as the window lets A send */
+/* at a time; and A_input of an ACK that is out of date, which is only  */
+/* the engine's sequence arithmetic.  The results are named after the   */
+/* engine, the window and sequence space if they were set, and whether  */
+/* the generic kernels were used.                                       */
+static void microhandlers(const struct protocol *p)
+{
+  struct pkt *bad = newpkt();
+  const struct pkt *packet, *ack, *stale = NULL, *batch[MICROWINDOW];
+  struct msg message;
+  double t, sum = 0.0, asum = 0.0;
+  char name[64];
+  long i, n = 0;
+  int j, k;
+
+  if (window > 0 || seqspace > 0)
+    sprintf(name, "%s.w%ds%d", p->name, window, seqspace);
+  else
+    strcpy(name, p->name);
+  if (generickernels)
+    strcat(name, ".generic");
+  proto = p;
+  proto->A_init();
+  proto->B_init();
+  memset(bad, 'x', sizeof(*bad));
+  bad->length = MAXPAYLOAD;
+  bad->checksum = 0;
+  t = nsclock();
+  for (i=0; i<MICROOPS; i++)
+    proto->A_input(bad);
+  reportmicro(name, "checksum", nsclock() - t, MICROOPS);
+  releasepkt(bad);
+
+  memset(message.data, 'a', MSGSIZE);
+  t = nsclock();
+  for (i=0; i<MICROOPS; i++) {
+    proto->A_output(&message);
+    if ((packet = poppacket()) == NULL)
+      break;
+    proto->B_input(packet);
+    releasepkt(packet);
+    if ((ack = poppacket()) == NULL)
+      break;
+    proto->A_input(ack);
+    releasepkt(ack);
+  }
+  if (i < MICROOPS) {
+    printf("%s did not send or acknowledge a message in the microbenchmark\n", p->name);
+    clearevents();
+    return;
+  }
+  reportmicro(name, "transfer", nsclock() - t, MICROOPS);
+
+  /* a window of packets to B, then their ACKs to A */
+  while (n < MICROOPS) {
+    for (k=0; k<MICROWINDOW; k++) {
+      proto->A_output(&message);
+      if ((batch[k] = poppacket()) == NULL)
+        break;
+    }
+    t = nsclock();
+    for (j=0; j<k; j++)
+      proto->B_input(batch[j]);
+    sum += nsclock() - t;
+    for (j=0; j<k; j++) {
+      releasepkt(batch[j]);
+      batch[j] = poppacket();
+    }
+    t = nsclock();
+    for (j=0; j<k; j++)
+      proto->A_input(batch[j]);
+    asum += nsclock() - t;
+    for (j=0; j<k; j++) {
+      if (stale != NULL)
+        releasepkt(stale);
+      stale = batch[j];         /* the newest ACK, out of date once the next is in */
+    }
+    n += k;
+  }
+  reportmicro(name, "B_input", sum, n);
+  reportmicro(name, "A_input", asum, n);
+  t = nsclock();
+  for (i=0; i<MICROOPS; i++)
+    proto->A_input(stale);
+  reportmicro(name, "staleack", nsclock() - t, MICROOPS);
+  releasepkt(stale);
+  clearevents();
+}
+
+static void runmicro(void)
+{
+  int i;
+
+  TRACE = 0;
+  init();
+  clearevents();
+  microinsert();
+  microtolayer3();
+  for (i=0; i<nruns; i++) {
+    microhandlers(runs[i]);
+    generickernels = 1;         /* and again without the specialized kernels */
+    microhandlers(runs[i]);
+    generickernels = 0;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  int i;
+
+  parseargs(argc, argv);
+  if (microbench) {
+    arrivals = findarrivals(arrivalspec, jimsrand);
+    runmicro();
+    return EXIT_SUCCESS;
+  }
+  if (resumefrom != NULL) {
+    loadsettings(resumefrom);
+    if (sourcepath != NULL)
+      opensource(sourcepath);
+    printf("Enter TRACE:");
+    scanf("%d",&TRACE);
+  }
+  else
+    readparams();
+  arrivals = findarrivals(arrivalspec, jimsrand);
+  for (i=0; i<nruns; i++)     /* every run starts from the same seed */
+    simulate(runs[i]);
+  closeexport();
   return EXIT_SUCCESS;
 }
\ No newline at end of file
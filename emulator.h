@@ -1,40 +1,163 @@
 extern int TRACE;
 
+/* packet size and message coalescing, set from the command line */
+extern int mtu;           /* largest payload the sender may put in one packet */
+extern double flushdelay; /* time a partly filled packet may wait for more messages */
+extern int fecgroup;      /* data packets covered by one parity packet, 0 for no FEC */
+extern int window;        /* sender window in packets, 0 for the engine's own */
+extern int seqspace;      /* sequence numbers in use, 0 for the least the engine needs */
+extern int generickernels; /* use the generic instance of every kernel (see below) */
+extern long recvbuffer;   /* bytes of pool buffers the receiver may hold, 0 for no cap */
+extern int advertise;     /* receiver advertises the room it has left in each ACK */
+
 /* statistics updated by GBN */
-extern int total_ACKs_received;
-extern int packets_resent;       /* count of the number of packets resent  */
-extern int new_ACKs;      /* count of the number of acks correctly received */
-extern int packets_received;  /* count of the packets received by receiver */
-extern int window_full; /* count of the number of messages dropped due to full window */
+/* (long, as very long runs take these past the range of an int) */
+extern long total_ACKs_received;
+extern long packets_resent;       /* count of the number of packets resent  */
+extern long new_ACKs;      /* count of the number of acks correctly received */
+extern long packets_received;  /* count of the packets received by receiver */
+extern long window_full; /* count of the number of messages dropped due to full window */
+extern long parity_sent;       /* count of the FEC parity packets sent */
+extern long packets_recovered; /* count of the packets rebuilt from parity at the receiver */
+extern long recv_dropped;      /* count of the packets dropped with the receive buffer full */
+extern long recv_peak;         /* most bytes of pool buffers the receiver has held */
 
 #define   A    0
 #define   B    1
 
+#define   MSGSIZE     20    /* bytes in each message generated by layer 5 */
+#define   MSGHDRSIZE  1     /* length byte framing each message in a packet */
+#define   MAXPAYLOAD  1500  /* largest packet payload, mtu may not exceed it */
+#define   FECHDRSIZE  2     /* bytes a parity packet carries ahead of the XOR'd payloads */
+
 /* a "msg" is the data unit passed from layer 5 (teachers code) to layer  */
 /* 4 (students' code).  It contains the data (characters) to be delivered */
 /* to layer 5 via the students transport level protocol entities.         */
 struct msg {
-  char data[20];
+  char data[MSGSIZE];
 };
 
 /* a packet is the data unit passed from layer 4 (students code) to layer */
 /* 3 (teachers code).  Note the pre-defined packet structure, which all   */
-/* students must follow. */
+/* students must follow.  The payload holds length bytes: one or more    */
+/* messages, each preceded by a MSGHDRSIZE length field (see appendmsg).  */
 struct pkt {
   int seqnum;
   int acknum;
   int checksum;
-  char payload[20];
+  int length;
+  char payload[MAXPAYLOAD];
 };
 
-/* send to A or B (int), packet to send */
+/* packets travelling between layers 3 and 4 live in buffers owned by the */
+/* emulator.  newpkt() returns an empty packet holding one reference,      */
+/* holdpkt() takes another reference and releasepkt() drops one; the       */
+/* buffer goes back to the pool when its last reference is released.      */
+extern struct pkt *newpkt(void);
+extern const struct pkt *holdpkt(const struct pkt *);
+extern void releasepkt(const struct pkt *);
+/* growpool() adds n buffers in one block and returns its address, for a   */
+/* backend that registers packet memory with the kernel.                   */
+extern void *growpool(int n, size_t *len);
+extern long poolblocks;     /* blocks of buffers allocated so far */
+extern const long pktbufsize; /* bytes of memory one buffer takes */
+
+/* send to A or B (int), packet to send.  The emulator takes its own       */
+/* reference rather than a copy, so the caller may keep the packet (for    */
+/* example in a retransmit buffer) and send it again later.                */
+extern void tolayer3ref(int, const struct pkt *);
+
+/* send to A or B (int), packet to send (copied into a pool buffer) */
 extern void tolayer3(int, struct pkt);  
 
-/* deliver to A or B (int), data to deliver */
-extern void tolayer5(int, char[20]); 
+/* add a message to the end of a packet's payload.  Returns 0 (and leaves */
+/* the packet alone) if the message would take the payload past mtu.     */
+extern int appendmsg(struct pkt *, const struct msg *);
+
+/* deliver to A or B (int) every message framed in the payload of a pool */
+/* packet, in turn; the application may keep a reference to the packet   */
+extern void tolayer5n(int, const struct pkt *);
+
+/* deliver to A or B (int), a single unframed message */
+extern void tolayer5(int, const char[MSGSIZE]); 
 
 /* start timer at A or B (int), increment */
 extern void starttimer(int, double);       
 
 /* stop timer at A or B (int) */
 extern void stoptimer(int);               
+
+/* start/stop the flush timer at A or B (int), which calls the entity's   */
+/* flushinterrupt routine when a partly filled packet has waited long     */
+/* enough; it runs independently of the retransmission timer              */
+extern void startflushtimer(int, double);
+extern void stopflushtimer(int);
+
+/* included for extension to bidirectional communication */
+#define BIDIRECTIONAL 0       /*  0 = A->B  1 =  A<->B */
+
+/* a protocol engine (layer 4): the routines the emulator calls for each  */
+/* entity.  Every engine is compiled in and one is chosen with -p.        */
+struct protocol {
+  const char *name;
+  void (*A_init)(void);
+  void (*A_output)(const struct msg *);
+  void (*A_input)(const struct pkt *);
+  void (*A_timerinterrupt)(void);
+  void (*A_flushinterrupt)(void);
+  void (*B_init)(void);
+  void (*B_output)(const struct msg *);
+  void (*B_input)(const struct pkt *);
+  void (*B_timerinterrupt)(void);
+  void (*B_flushinterrupt)(void);
+  void (*save)(FILE *);      /* write the state of both entities to a snapshot */
+  void (*restore)(FILE *);   /* read it back, after A_init and B_init */
+  int (*inflight)(void);     /* packets A has sent that are not yet acknowledged */
+};
+
+/* the largest sequence space an engine supports, and so its window */
+#define MAXSEQSPACE  4096
+
+/* The engines' hot routines are kernels: written once with the window  */
+/* and sequence space as arguments and always inlined, so an instance   */
+/* with constant arguments has its sequence arithmetic folded (a mask   */
+/* for a power of two, a multiply otherwise).  An engine keeps a       */
+/* constant instance only where bench -M measures a steady gain, and a  */
+/* generic one for the rest.                                            */
+#ifdef __GNUC__
+#define KERNEL  static __inline__ __attribute__((always_inline))
+#else
+#define KERNEL  static
+#endif
+/* sequence numbers modulo s: the one after x, and the distance from a to b */
+#define SEQNEXT(x, s)     ((int)(((unsigned)(x) + 1) % (unsigned)(s)))
+#define SEQDIST(a, b, s)  ((int)(((unsigned)(b) + (unsigned)(s) - (unsigned)(a)) % (unsigned)(s)))
+
+/* snapshot encoding, for the engines' save and restore routines.  Integers */
+/* are variable length, doubles keep every bit, and a packet is stored by   */
+/* value (NULL allowed); loadpkt() returns a new pool packet.  A short or   */
+/* damaged snapshot makes the load routines exit.                           */
+extern void saveint(FILE *, long);
+extern long loadint(FILE *);
+extern void savedouble(FILE *, double);
+extern double loaddouble(FILE *);
+extern void savepkt(FILE *, const struct pkt *);
+extern struct pkt *loadpkt(FILE *);
+
+/* the following are for the network backends (emulator.c and udp.c), */
+/* which share packet.c; the protocol engines do not use them          */
+extern const struct protocol *engines[];   /* every engine, NULL terminated */
+extern const struct protocol *findprotocol(const char *);
+
+/* command line settings common to every backend (-m, -f, -k, ...): consume */
+/* argv[*i] if it is one, and check the values once all are read       */
+#define SETTINGSUSAGE "[-m mtu] [-f flushdelay] [-k fecgroup] [-w window] [-q seqspace]\n" \
+                      "          [-b receive buffer bytes] [-B drop|advertise]"
+extern int settingarg(int, char **, int *);
+extern void checksettings(void);
+
+/* hand one message of length (int) bytes to the application at A or B */
+/* (int); supplied by each backend and called by tolayer5/tolayer5n.   */
+/* The message lies in the pool packet given, which the application    */
+/* may hold on to, or the packet is NULL if it was not framed in one.  */
+extern void deliver(int, const struct pkt *, const char *, int);
@@ -20,6 +20,11 @@
    - removed bidirectional GBN code and other code not used by prac.
    - fixed C style to adhere to current programming style
    - added GBN implementation
+   - the window and sequence space may be set with -w and -q; the hot
+   routines are kernels (see emulator.h), with a constant instance for
+   a 1024 number sequence space
+   - forward error correction (-k) and the receive buffer cap (-b, -B)
+   are selective repeat's only; asking for them with GBN is an error
 **********************************************************************/
 
 #define RTT  16.0       /* round trip time.  MUST BE SET TO 16.0 when submitting assignment */
@@ -33,84 +38,133 @@
    original checksum.  This procedure must generate a different checksum to the original if
    the packet is corrupted.
 */
-int ComputeChecksum(struct pkt packet)
+static int ComputeChecksum(const struct pkt *packet)
 {
   int checksum = 0;
   int i;
 
-  checksum = packet.seqnum;
-  checksum += packet.acknum;
-  for ( i=0; i<20; i++ )
-    checksum += (int)(packet.payload[i]);
+  checksum = packet->seqnum;
+  checksum += packet->acknum;
+  checksum += packet->length;
+  for ( i=0; i<packet->length; i++ )
+    checksum += (int)(packet->payload[i]);
 
   return checksum;
 }
 
-bool IsCorrupted(struct pkt packet)
+static bool IsCorrupted(const struct pkt *packet)
 {
-  if (packet.checksum == ComputeChecksum(packet))
+  if (packet->length < 0 || packet->length > MAXPAYLOAD)
+    return (true);
+  if (packet->checksum == ComputeChecksum(packet))
     return (false);
   else
     return (true);
 }
 
 
+static int winsize, seqsize;           /* window and sequence space of the run */
+static void choosekernel(void);
+
+
 /********* Sender (A) variables and functions ************/
 
-static struct pkt buffer[WINDOWSIZE];  /* array for storing packets waiting for ACK */
+static const struct pkt *buffer[MAXSEQSPACE];  /* packets waiting for ACK, shared with layer 3 */
 static int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
 static int windowcount;                /* the number of packets currently awaiting an ACK */
 static int A_nextseqnum;               /* the next sequence number to be used by the sender */
 
-/* called from layer 5 (application layer), passed the message to be sent to other side */
-void A_output(struct msg message)
+static struct pkt *pending;            /* packet collecting messages, not yet sent */
+static bool flushdue;                  /* pending packet has waited flushdelay */
+static bool flushtimer;                /* flush timer is running */
+
+/* true if the pending packet should go out as soon as the window allows */
+static bool PendingReady(void)
 {
-  struct pkt sendpkt;
-  int i;
+  return flushdue || pending->length + MSGHDRSIZE + MSGSIZE > mtu;
+}
 
-  /* if not blocked waiting on ACK */
-  if ( windowcount < WINDOWSIZE) {
-    if (TRACE > 1)
-      printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
+/* number the pending packet and send it; the window must have room */
+KERNEL void SendPending(int W, int S)
+{
+  struct pkt *sendpkt = pending;
 
-    /* create packet */
-    sendpkt.seqnum = A_nextseqnum;
-    sendpkt.acknum = NOTINUSE;
-    for ( i=0; i<20 ; i++ )
-      sendpkt.payload[i] = message.data[i];
-    sendpkt.checksum = ComputeChecksum(sendpkt);
+  pending = NULL;
+  flushdue = false;
+  if (flushtimer) {
+    stopflushtimer(A);
+    flushtimer = false;
+  }
 
-    /* put packet in window buffer */
-    /* windowlast will always be 0 for alternating bit; but not for GoBackN */
-    windowlast = (windowlast + 1) % WINDOWSIZE;
-    buffer[windowlast] = sendpkt;
-    windowcount++;
+  /* create packet */
+  sendpkt->seqnum = A_nextseqnum;
+  sendpkt->acknum = NOTINUSE;
+  sendpkt->checksum = ComputeChecksum(sendpkt);
 
-    /* send out packet */
-    if (TRACE > 0)
-      printf("Sending packet %d to layer 3\n", sendpkt.seqnum);
-    tolayer3 (A, sendpkt);
+  /* put packet in window buffer, the buffer keeps the reference from newpkt() */
+  /* windowlast will always be 0 for alternating bit; but not for GoBackN */
+  windowlast = windowlast + 1 == W ? 0 : windowlast + 1;
+  buffer[windowlast] = sendpkt;
+  windowcount++;
 
-    /* start timer if first packet in window */
-    if (windowcount == 1)
-      starttimer(A,RTT);
+  /* send out packet */
+  if (TRACE > 0)
+    printf("Sending packet %d to layer 3\n", sendpkt->seqnum);
+  tolayer3ref (A, sendpkt);
+
+  /* start timer if first packet in window */
+  if (windowcount == 1)
+    starttimer(A,RTT);
+
+  /* get next sequence number, wrap back to 0 */
+  A_nextseqnum = SEQNEXT(A_nextseqnum, S);
+}
 
-    /* get next sequence number, wrap back to 0 */
-    A_nextseqnum = (A_nextseqnum + 1) % SEQSPACE;
+/* called from layer 5 (application layer), passed the message to be sent to other side */
+KERNEL void A_outputk(const struct msg *message, int W, int S)
+{
+  /* coalesce with messages already waiting if the packet has room */
+  if (pending != NULL && appendmsg(pending, message)) {
+    if (TRACE > 1)
+      printf("----A: New message arrives, added to pending packet\n");
+  }
+  /* if not blocked waiting on ACK */
+  else if ( windowcount < W) {
+    if (TRACE > 1)
+      printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
+
+    /* a full pending packet goes first */
+    if (pending != NULL)
+      SendPending(W, S);
+
+    /* put message into a new packet */
+    pending = newpkt();
+    pending->length = 0;
+    appendmsg(pending, message);
+    if (flushdelay > 0.0) {
+      startflushtimer(A, flushdelay);
+      flushtimer = true;
+    }
+    else
+      flushdue = true;
   }
   /* if blocked,  window is full */
   else {
     if (TRACE > 0)
       printf("----A: New message arrives, send window is full\n");
     window_full++;
+    return;
   }
+
+  if (PendingReady() && windowcount < W)
+    SendPending(W, S);
 }
 
 
 /* called from layer 3, when a packet arrives for layer 4
    In this practical this will always be an ACK as B never sends data.
 */
-void A_input(struct pkt packet)
+KERNEL void A_inputk(const struct pkt *packet, int W, int S)
 {
   int ackcount = 0;
   int i;
@@ -118,40 +172,45 @@ void A_input(struct pkt packet)
   /* if received ACK is not corrupted */
   if (!IsCorrupted(packet)) {
     if (TRACE > 0)
-      printf("----A: uncorrupted ACK %d is received\n",packet.acknum);
+      printf("----A: uncorrupted ACK %d is received\n",packet->acknum);
     total_ACKs_received++;
 
     /* check if new ACK or duplicate */
     if (windowcount != 0) {
-          int seqfirst = buffer[windowfirst].seqnum;
-          int seqlast = buffer[windowlast].seqnum;
+          int seqfirst = buffer[windowfirst]->seqnum;
+          int seqlast = buffer[windowlast]->seqnum;
           /* check case when seqnum has and hasn't wrapped */
-          if (((seqfirst <= seqlast) && (packet.acknum >= seqfirst && packet.acknum <= seqlast)) ||
-              ((seqfirst > seqlast) && (packet.acknum >= seqfirst || packet.acknum <= seqlast))) {
+          if (((seqfirst <= seqlast) && (packet->acknum >= seqfirst && packet->acknum <= seqlast)) ||
+              ((seqfirst > seqlast) && (packet->acknum >= seqfirst || packet->acknum <= seqlast))) {
 
             /* packet is a new ACK */
             if (TRACE > 0)
-              printf("----A: ACK %d is not a duplicate\n",packet.acknum);
+              printf("----A: ACK %d is not a duplicate\n",packet->acknum);
             new_ACKs++;
 
             /* cumulative acknowledgement - determine how many packets are ACKed */
-            if (packet.acknum >= seqfirst)
-              ackcount = packet.acknum + 1 - seqfirst;
+            if (packet->acknum >= seqfirst)
+              ackcount = packet->acknum + 1 - seqfirst;
             else
-              ackcount = SEQSPACE - seqfirst + packet.acknum;
-
-	    /* slide window by the number of packets ACKed */
-            windowfirst = (windowfirst + ackcount) % WINDOWSIZE;
+              ackcount = S - seqfirst + packet->acknum;
 
             /* delete the acked packets from window buffer */
-            for (i=0; i<ackcount; i++)
+            for (i=0; i<ackcount; i++) {
+              releasepkt(buffer[windowfirst]);
+              buffer[windowfirst] = NULL;
+              windowfirst = windowfirst + 1 == W ? 0 : windowfirst + 1;
               windowcount--;
+            }
 
 	    /* start timer again if there are still more unacked packets in window */
             stoptimer(A);
             if (windowcount > 0)
               starttimer(A, RTT);
 
+            /* the window has opened, a waiting packet can go */
+            if (pending != NULL && PendingReady())
+              SendPending(W, S);
+
           }
         }
         else
@@ -164,30 +223,59 @@ void A_input(struct pkt packet)
 }
 
 /* called when A's timer goes off */
-void A_timerinterrupt(void)
+static void A_timerinterrupt(void)
 {
-  int i;
+  int i, slot;
 
   if (TRACE > 0)
     printf("----A: time out,resend packets!\n");
 
-  for(i=0; i<windowcount; i++) {
+  for(i=0, slot=windowfirst; i<windowcount; i++, slot = slot + 1 == winsize ? 0 : slot + 1) {
 
     if (TRACE > 0)
-      printf ("---A: resending packet %d\n", (buffer[(windowfirst+i) % WINDOWSIZE]).seqnum);
+      printf ("---A: resending packet %d\n", buffer[slot]->seqnum);
 
-    tolayer3(A,buffer[(windowfirst+i) % WINDOWSIZE]);
+    tolayer3ref(A,buffer[slot]);
     packets_resent++;
     if (i==0) starttimer(A,RTT);
   }
 }
 
+/* called when A's flush timer goes off, the pending packet has waited long enough */
+static void A_flushinterrupt(void)
+{
+  flushtimer = false;
+  flushdue = true;
+  if (windowcount < winsize)
+    SendPending(winsize, seqsize);
+}
+
 
 
 /* the following routine will be called once (only) before any other */
 /* entity A routines are called. You can use it to do any initialization */
-void A_init(void)
+static void A_init(void)
 {
+  int i;
+
+  choosekernel();
+  if (fecgroup > 0) {
+    printf("go-back-N sends no parity packets: -k needs -p sr\n");
+    exit(EXIT_FAILURE);
+  }
+  if (recvbuffer > 0 || advertise) {
+    printf("go-back-N holds nothing out of order at B: -b and -B need -p sr\n");
+    exit(EXIT_FAILURE);
+  }
+  /* drop anything a previous run left behind */
+  for (i=0; i<MAXSEQSPACE; i++) {
+    if (buffer[i] != NULL)
+      releasepkt(buffer[i]);
+    buffer[i] = NULL;
+  }
+  if (pending != NULL)
+    releasepkt(pending);
+
   /* initialise A's window, buffer and sequence number */
   A_nextseqnum = 0;  /* A starts with seq num 0, do not change this */
   windowfirst = 0;
@@ -196,6 +284,9 @@ void A_init(void)
 		     so initially this is set to -1
 		   */
   windowcount = 0;
+  pending = NULL;
+  flushdue = false;
+  flushtimer = false;
 }
 
 
@@ -207,55 +298,57 @@ static int B_nextseqnum;   /* the sequence number for the next packets sent by B
 
 
 /* called from layer 3, when a packet arrives for layer 4 at B*/
-void B_input(struct pkt packet)
+KERNEL void B_inputk(const struct pkt *packet, int S)
 {
-  struct pkt sendpkt;
-  int i;
+  struct pkt *sendpkt;
+
+  sendpkt = newpkt();
 
   /* if not corrupted and received packet is in order */
-  if  ( (!IsCorrupted(packet))  && (packet.seqnum == expectedseqnum) ) {
+  if  ( (!IsCorrupted(packet))  && (packet->seqnum == expectedseqnum) ) {
     if (TRACE > 0)
-      printf("----B: packet %d is correctly received, send ACK!\n",packet.seqnum);
+      printf("----B: packet %d is correctly received, send ACK!\n",packet->seqnum);
     packets_received++;
 
     /* deliver to receiving application */
-    tolayer5(B, packet.payload);
+    tolayer5n(B, packet);
 
     /* send an ACK for the received packet */
-    sendpkt.acknum = expectedseqnum;
+    sendpkt->acknum = expectedseqnum;
 
     /* update state variables */
-    expectedseqnum = (expectedseqnum + 1) % SEQSPACE;
+    expectedseqnum = SEQNEXT(expectedseqnum, S);
   }
   else {
     /* packet is corrupted or out of order resend last ACK */
     if (TRACE > 0)
       printf("----B: packet corrupted or not expected sequence number, resend ACK!\n");
     if (expectedseqnum == 0)
-      sendpkt.acknum = SEQSPACE - 1;
+      sendpkt->acknum = S - 1;
     else
-      sendpkt.acknum = expectedseqnum - 1;
+      sendpkt->acknum = expectedseqnum - 1;
   }
 
   /* create packet */
-  sendpkt.seqnum = B_nextseqnum;
+  sendpkt->seqnum = B_nextseqnum;
   B_nextseqnum = (B_nextseqnum + 1) % 2;
 
-  /* we don't have any data to send.  fill payload with 0's */
-  for ( i=0; i<20 ; i++ )
-    sendpkt.payload[i] = '0';
+  /* we don't have any data to send */
+  sendpkt->length = 0;
 
   /* computer checksum */
-  sendpkt.checksum = ComputeChecksum(sendpkt);
+  sendpkt->checksum = ComputeChecksum(sendpkt);
 
-  /* send out packet */
-  tolayer3 (B, sendpkt);
+  /* send out packet, layer 3 holds its own reference */
+  tolayer3ref (B, sendpkt);
+  releasepkt(sendpkt);
 }
 
 /* the following routine will be called once (only) before any other */
 /* entity B routines are called. You can use it to do any initialization */
-void B_init(void)
+static void B_init(void)
 {
+  choosekernel();
   expectedseqnum = 0;
   B_nextseqnum = 1;
 }
@@ -265,11 +358,124 @@ void B_init(void)
  *****************************************************************************/
 
 /* Note that with simplex transfer from a-to-B, there is no B_output() */
-void B_output(struct msg message)
+static void B_output(const struct msg *message)
 {
 }
 
 /* called when B's timer goes off */
-void B_timerinterrupt(void)
+static void B_timerinterrupt(void)
+{
+}
+
+/* called when B's flush timer goes off */
+static void B_flushinterrupt(void)
 {
 }
+
+/************************** KERNEL INSTANCES *******/
+/* a 1024 number sequence space with the window as set, the only one  */
+/* where -M shows a steady gain over the generic fallback, on a stale  */
+/* ACK (the sequence arithmetic alone) at -w 512 -q 1024; there is     */
+/* none to measure at the default sizes or in other power of two spaces */
+#define INSTANCE(name, W, S) \
+  static void name##_A_output(const struct msg *message) { A_outputk(message, W, S); } \
+  static void name##_A_input(const struct pkt *packet) { A_inputk(packet, W, S); } \
+  static void name##_B_input(const struct pkt *packet) { B_inputk(packet, S); }
+#define ENTRY(name, W, S) { W, S, name##_A_output, name##_A_input, name##_B_input }
+
+INSTANCE(s1024, winsize, 1024)
+INSTANCE(generic, winsize, seqsize)
+
+struct kernel {
+  int window, seqspace;                /* window 0 for any */
+  void (*A_output)(const struct msg *);
+  void (*A_input)(const struct pkt *);
+  void (*B_input)(const struct pkt *);
+};
+
+static const struct kernel kernels[] = {
+  ENTRY(s1024, 0, 1024),
+  ENTRY(generic, 0, 0)
+};
+static const struct kernel *kernel = &kernels[0];   /* instance for the run */
+
+/* size the window and sequence space from the settings and pick the */
+/* instance for them.  Go back N needs one number more than the window. */
+static void choosekernel(void)
+{
+  winsize = window > 0 ? window : WINDOWSIZE;
+  seqsize = seqspace > 0 ? seqspace : window > 0 ? window + 1 : SEQSPACE;
+  if (seqsize < winsize + 1) {
+    printf("gbn needs a sequence space of at least the window plus one (%d)\n", winsize + 1);
+    exit(EXIT_FAILURE);
+  }
+  for (kernel = kernels; kernel->seqspace != 0; kernel++)
+    if (!generickernels && kernel->seqspace == seqsize
+        && (kernel->window == 0 || kernel->window == winsize))
+      break;
+}
+
+static void A_output(const struct msg *message)
+{
+  kernel->A_output(message);
+}
+
+static void A_input(const struct pkt *packet)
+{
+  kernel->A_input(packet);
+}
+
+static void B_input(const struct pkt *packet)
+{
+  kernel->B_input(packet);
+}
+
+/* write A's window and B's receive state to a snapshot */
+static void save(FILE *f)
+{
+  int i;
+
+  for (i=0; i<winsize; i++)
+    savepkt(f, buffer[i]);
+  saveint(f, windowfirst);
+  saveint(f, windowlast);
+  saveint(f, windowcount);
+  saveint(f, A_nextseqnum);
+  savepkt(f, pending);
+  saveint(f, flushdue);
+  saveint(f, flushtimer);
+  saveint(f, expectedseqnum);
+  saveint(f, B_nextseqnum);
+}
+
+/* read back what save() wrote; A_init and B_init have just run */
+static void restore(FILE *f)
+{
+  int i;
+
+  for (i=0; i<winsize; i++)
+    buffer[i] = loadpkt(f);
+  windowfirst = loadint(f);
+  windowlast = loadint(f);
+  windowcount = loadint(f);
+  A_nextseqnum = loadint(f);
+  pending = loadpkt(f);
+  flushdue = loadint(f);
+  flushtimer = loadint(f);
+  expectedseqnum = loadint(f);
+  B_nextseqnum = loadint(f);
+}
+
+/* the occupancy of A's window, for the emulator's statistics */
+static int inflight(void)
+{
+  return windowcount;
+}
+
+/* the entry points the emulator calls when this protocol is selected */
+const struct protocol gbn_protocol = {
+  "gbn",
+  A_init, A_output, A_input, A_timerinterrupt, A_flushinterrupt,
+  B_init, B_output, B_input, B_timerinterrupt, B_flushinterrupt,
+  save, restore, inflight
+};
@@ -0,0 +1,361 @@
+/* ******************************************************************
+   MONTE CARLO DRIVER
+
+   Runs independent replications of one configuration until its results
+   are known to a requested precision, instead of a fixed number of
+   runs of a fixed length:
+   - each replication is ./rdt with its own seed (-s), several running
+   at a time
+   - a running mean and variance (Welford) is kept of the goodput
+   (bytes delivered per time unit), the resends per message delivered
+   and the p99 message delay
+   - once at least the minimum number of runs is in, the driver stops
+   starting new ones as soon as the confidence interval of every metric
+   is narrower than the relative half-width requested; the replications
+   still running are waited for and counted
+   - it reports each interval and the number of runs used, and exits
+   with status 1 if the maximum number of runs did not get there
+
+   Arguments after -- are passed on to rdt, e.g. -- -m 210 -f 50.
+   ****************************************************************** */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define  MAXJOBS     256
+#define  MAXARGS     64
+#define  MAXOUTPUT   (1 << 16)  /* rdt output kept for parsing */
+
+#define  GOODPUT  0
+#define  RESENDS  1
+#define  P99      2
+#define  NMETRICS 3
+
+static const char *const metricnames[NMETRICS] = {
+  "goodput (bytes per time unit)", "resends per message", "p99 message delay"
+};
+
+/* running mean and variance of one metric */
+struct moments {
+  long n;
+  double mean, m2;
+};
+
+static struct moments stats[NMETRICS];
+
+/* a replication in progress */
+struct child {
+  pid_t pid;
+  int fd;               /* its output */
+  long seed;
+  size_t used;
+  char output[MAXOUTPUT];
+};
+
+static struct child *children[MAXJOBS];
+static int running;
+
+static const char *rdt = "./rdt";
+static const char *protocol = "gbn";
+static char *rdtargs[MAXARGS];
+static int nrdtargs;
+static char input[128];
+
+static void fail(const char *what)
+{
+  perror(what);
+  exit(EXIT_FAILURE);
+}
+
+/* Welford's update, stable however many runs are added */
+static void addsample(struct moments *s, double x)
+{
+  double delta = x - s->mean;
+
+  s->n++;
+  s->mean += delta / s->n;
+  s->m2 += delta * (x - s->mean);
+}
+
+/* the two sided confidence levels offered, with their normal quantile */
+/* and Student's t quantile for 1 to TEXACT-1 degrees of freedom      */
+#define  TEXACT  30
+
+static const struct level {
+  int percent;
+  double z;
+  double t[TEXACT];
+} levels[] = {
+  { 90, 1.644854, { 0.0,
+      6.313752, 2.919986, 2.353363, 2.131847, 2.015048, 1.943180, 1.894579, 1.859548,
+      1.833113, 1.812461, 1.795885, 1.782288, 1.770933, 1.761310, 1.753050, 1.745884,
+      1.739607, 1.734064, 1.729133, 1.724718, 1.720743, 1.717144, 1.713872, 1.710882,
+      1.708141, 1.705618, 1.703288, 1.701131, 1.699127 } },
+  { 95, 1.959964, { 0.0,
+      12.706205, 4.302653, 3.182446, 2.776445, 2.570582, 2.446912, 2.364624, 2.306004,
+      2.262157, 2.228139, 2.200985, 2.178813, 2.160369, 2.144787, 2.131450, 2.119905,
+      2.109816, 2.100922, 2.093024, 2.085963, 2.079614, 2.073873, 2.068658, 2.063899,
+      2.059539, 2.055529, 2.051831, 2.048407, 2.045230 } },
+  { 99, 2.575829, { 0.0,
+      63.656741, 9.924843, 5.840909, 4.604095, 4.032143, 3.707428, 3.499483, 3.355387,
+      3.249836, 3.169273, 3.105807, 3.054540, 3.012276, 2.976843, 2.946713, 2.920782,
+      2.898231, 2.878440, 2.860935, 2.845340, 2.831360, 2.818756, 2.807336, 2.796940,
+      2.787436, 2.778715, 2.770683, 2.763262, 2.756386 } },
+  { 0, 0.0, { 0.0 } }
+};
+
+/* Student's t quantile at the level: from the table for few degrees  */
+/* of freedom, where the expansion is far off (7.1 for 12.71 at one), */
+/* and by the Cornish-Fisher expansion from TEXACT on, within 0.001   */
+static double tquantile(const struct level *c, long df)
+{
+  double z = c->z, z3 = z * z * z, z5 = z3 * z * z;
+
+  if (df < TEXACT)
+    return c->t[df];
+  return z + (z3 + z) / (4.0 * df) + (5.0 * z5 + 16.0 * z3 + 3.0 * z) / (96.0 * df * df);
+}
+
+static double halfwidth(const struct moments *s, const struct level *c)
+{
+  if (s->n < 2)
+    return HUGE_VAL;
+  return tquantile(c, s->n - 1) * sqrt(s->m2 / (s->n - 1) / s->n);
+}
+
+/* every interval at most width times its mean (an exact zero counts) */
+static int converged(const struct level *c, double width)
+{
+  double h;
+  int i;
+
+  for (i=0; i<NMETRICS; i++) {
+    h = halfwidth(&stats[i], c);
+    if (h > width * fabs(stats[i].mean))
+      return 0;
+  }
+  return 1;
+}
+
+/********************** RUNNING RDT *******************/
+static void startrun(long seed)
+{
+  struct child *c = malloc(sizeof(struct child));
+  char seedarg[32], *argv[MAXARGS + 8];
+  int in[2], out[2], n = 0, i;
+
+  if (c == NULL)
+    fail("malloc");
+  sprintf(seedarg, "%ld", seed);
+  argv[n++] = (char *)rdt;
+  argv[n++] = "-p";
+  argv[n++] = (char *)protocol;
+  argv[n++] = "-s";
+  argv[n++] = seedarg;
+  for (i=0; i<nrdtargs; i++)
+    argv[n++] = rdtargs[i];
+  argv[n] = NULL;
+
+  if (pipe(in) < 0 || pipe(out) < 0)
+    fail("pipe");
+  if ((c->pid = fork()) < 0)
+    fail("fork");
+  if (c->pid == 0) {
+    dup2(in[0], STDIN_FILENO);
+    dup2(out[1], STDOUT_FILENO);
+    close(in[0]);
+    close(in[1]);
+    close(out[0]);
+    close(out[1]);
+    execv(rdt, argv);
+    perror(rdt);
+    _exit(127);
+  }
+  close(in[0]);
+  close(out[1]);
+  if (write(in[1], input, strlen(input)) < 0)
+    fail("write");
+  close(in[1]);
+  c->fd = out[0];
+  c->seed = seed;
+  c->used = 0;
+  children[running++] = c;
+}
+
+/* the number after label in rdt's output, after the text where if given */
+static double field(const struct child *c, const char *where, const char *label)
+{
+  const char *p = c->output;
+
+  if (where != NULL && (p = strstr(p, where)) == NULL)
+    p = "";
+  if ((p = strstr(p, label)) == NULL) {
+    printf("rdt with seed %ld did not report \"%s%s%s\"\n", c->seed,
+           where != NULL ? where : "", where != NULL ? " " : "", label);
+    exit(EXIT_FAILURE);
+  }
+  return atof(p + strlen(label));
+}
+
+/* a replication has finished: add its results */
+static void finishrun(struct child *c)
+{
+  double time, bytes, delivered;
+  int status;
+
+  if (waitpid(c->pid, &status, 0) < 0)
+    fail("waitpid");
+  c->output[c->used] = '\0';
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    printf("%s with seed %ld failed:\n%s\n", rdt, c->seed, c->output);
+    exit(EXIT_FAILURE);
+  }
+  time = field(c, NULL, "terminated at time");
+  bytes = field(c, NULL, "number of bytes delivered to application:");
+  delivered = field(c, NULL, "number of messages delivered to application:");
+  if (delivered == 0.0) {
+    printf("rdt with seed %ld delivered no messages\n", c->seed);
+    exit(EXIT_FAILURE);
+  }
+  addsample(&stats[GOODPUT], bytes / time);
+  addsample(&stats[RESENDS], field(c, NULL, "number of packet resends by A:") / delivered);
+  addsample(&stats[P99], field(c, "message delay:", "p99"));
+}
+
+/* read from the replications running until one finishes */
+static void waitrun(void)
+{
+  struct pollfd fds[MAXJOBS];
+  struct child *c;
+  ssize_t n;
+  int i;
+
+  for (;;) {
+    for (i=0; i<running; i++) {
+      fds[i].fd = children[i]->fd;
+      fds[i].events = POLLIN;
+    }
+    if (poll(fds, running, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      fail("poll");
+    }
+    for (i=0; i<running; i++) {
+      if (fds[i].revents == 0)
+        continue;
+      c = children[i];
+      /* keep the last MAXOUTPUT bytes, where the report is */
+      n = read(c->fd, c->output + c->used, MAXOUTPUT - 1 - c->used);
+      if (n < 0 && errno != EINTR)
+        fail("read");
+      if (n > 0) {
+        c->used += n;
+        if (c->used == MAXOUTPUT - 1) {
+          memmove(c->output, c->output + c->used / 2, c->used - c->used / 2);
+          c->used -= c->used / 2;
+        }
+      }
+      else if (n == 0) {
+        close(c->fd);
+        finishrun(c);
+        free(c);
+        children[i] = children[--running];
+        return;
+      }
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  double loss = 0.1, corruption = 0.0, lambda = 100.0, width = 0.05;
+  const struct level *c;
+  long messages = 10000, minruns = 5, maxruns = 1000, seed = 1, started = 0;
+  int jobs = (int)sysconf(_SC_NPROCESSORS_ONLN), confidence = 95, i;
+
+  for (i=1; i<argc; i++) {
+    if (strcmp(argv[i], "-r") == 0 && i+1 < argc)
+      rdt = argv[++i];
+    else if (strcmp(argv[i], "-p") == 0 && i+1 < argc)
+      protocol = argv[++i];
+    else if (strcmp(argv[i], "-n") == 0 && i+1 < argc)
+      messages = atol(argv[++i]);
+    else if (strcmp(argv[i], "-l") == 0 && i+1 < argc)
+      loss = atof(argv[++i]);
+    else if (strcmp(argv[i], "-c") == 0 && i+1 < argc)
+      corruption = atof(argv[++i]);
+    else if (strcmp(argv[i], "-L") == 0 && i+1 < argc)
+      lambda = atof(argv[++i]);
+    else if (strcmp(argv[i], "-w") == 0 && i+1 < argc)
+      width = atof(argv[++i]) / 100.0;
+    else if (strcmp(argv[i], "-C") == 0 && i+1 < argc)
+      confidence = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-j") == 0 && i+1 < argc)
+      jobs = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-k") == 0 && i+1 < argc)
+      minruns = atol(argv[++i]);
+    else if (strcmp(argv[i], "-K") == 0 && i+1 < argc)
+      maxruns = atol(argv[++i]);
+    else if (strcmp(argv[i], "-s") == 0 && i+1 < argc)
+      seed = atol(argv[++i]);
+    else if (strcmp(argv[i], "--") == 0 && argc - i - 1 <= MAXARGS) {
+      for (i++; i<argc; i++)
+        rdtargs[nrdtargs++] = argv[i];
+    }
+    else {
+      printf("usage: %s [-r rdt] [-p gbn|sr] [-n messages per run] [-l loss] [-c corruption]\n"
+             "          [-L lambda] [-w relative half-width %%] [-C 90|95|99 (confidence %%)]\n"
+             "          [-j parallel runs] [-k min runs] [-K max runs] [-s first seed]\n"
+             "          [-- rdt arguments]\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (c=levels; c->percent!=0 && c->percent!=confidence; c++)
+    ;
+  if (c->percent == 0) {
+    printf("the confidence level may be 90, 95 or 99%%\n");
+    exit(EXIT_FAILURE);
+  }
+  if (jobs < 1)
+    jobs = 1;
+  if (jobs > MAXJOBS)
+    jobs = MAXJOBS;
+  if (minruns < 2)
+    minruns = 2;
+
+  /* messages, loss, corruption, direction (asked only with loss or corruption), lambda, trace */
+  if (loss > 0.0 || corruption > 0.0)
+    sprintf(input, "%ld\n%f\n%f\n2\n%f\n0\n", messages, loss, corruption, lambda);
+  else
+    sprintf(input, "%ld\n0.0\n0.0\n%f\n0\n", messages, lambda);
+
+  for (;;) {
+    while (running < jobs && started < maxruns
+           && (stats[0].n < minruns || !converged(c, width))) {
+      startrun(seed + started);
+      started++;
+    }
+    if (running == 0)
+      break;
+    waitrun();
+  }
+
+  printf("%s, %ld messages per run, loss %g, corruption %g, lambda %g: %ld runs\n",
+         protocol, messages, loss, corruption, lambda, stats[0].n);
+  for (i=0; i<NMETRICS; i++)
+    printf("  %-30s %14.6f +- %-12.6f (%.2f%%, %d%% confidence)\n", metricnames[i],
+           stats[i].mean, halfwidth(&stats[i], c),
+           stats[i].mean != 0.0 ? 100.0 * halfwidth(&stats[i], c) / fabs(stats[i].mean) : 0.0,
+           confidence);
+  if (!converged(c, width)) {
+    printf("the intervals did not reach %.2f%% in %ld runs\n", 100.0 * width, maxruns);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,308 @@
+/* ******************************************************************
+   Layer 3/4 support shared by the network backends: the emulator
+   (emulator.c) and the UDP transport (udp.c).  It holds the packet pool,
+   the framing of messages inside packets, the table of protocol engines
+   and the settings and statistics the engines use.
+
+   Each backend supplies tolayer3ref(), the timer routines and deliver(),
+   which hands one message to its application.
+   ****************************************************************** */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "emulator.h"
+#include "gbn.h"
+#include "sr.h"
+
+/* packet buffers handed out by newpkt().  The pkt must stay the first    */
+/* member so a struct pkt pointer can be turned back into its buffer.      */
+struct pktbuf {
+  struct pkt pkt;
+  int refcount;             /* number of holders (events, senders, ...) */
+  struct pktbuf *nextfree;  /* link in the free list when not in use */
+};
+
+#define  PKTCHUNK       64  /* buffers obtained from malloc at a time */
+
+static struct pktbuf *pktfree = NULL;  /* pool of unused packet buffers */
+long poolblocks = 0;                   /* blocks of buffers allocated */
+const long pktbufsize = sizeof(struct pktbuf);
+
+int TRACE = 3;
+
+int mtu = MSGHDRSIZE + MSGSIZE;  /* default: one message per packet */
+double flushdelay = 0.0;         /* default: send as soon as a message arrives */
+int fecgroup = 0;                /* default: no parity packets */
+int window = 0;                  /* default: each engine's own window */
+int seqspace = 0;
+int generickernels = 0;
+long recvbuffer = 0;             /* default: no cap on the receive buffer */
+int advertise = 0;               /* default: drop what does not fit */
+
+/* statistics updated by GBN */
+long window_full;   /* count of the number of messages dropped due to full window */
+long total_ACKs_received;
+long packets_resent;       /* count of the number of packets resent  */
+long new_ACKs;           /* count of the number of acks correctly received */
+long packets_received;  /* count of the packets received by receiver */
+long parity_sent;       /* count of the FEC parity packets sent */
+long packets_recovered; /* count of the packets rebuilt from parity at the receiver */
+long recv_dropped;      /* count of the packets dropped with the receive buffer full */
+long recv_peak;         /* most bytes of pool buffers the receiver has held */
+
+/* every protocol engine compiled in */
+const struct protocol *engines[] = { &gbn_protocol, &sr_protocol, NULL };
+
+/************************** PACKET POOL ************/
+/* add n buffers to the free list in one block of memory and return it,  */
+/* so a backend can register the block with the kernel (len gets its size) */
+void *growpool(int n, size_t *len)
+{
+  struct pktbuf *b;
+  int i;
+
+  b = malloc(n * sizeof(struct pktbuf));
+  if (b == 0) {
+    printf("memory allocation for packet failed.");
+    exit(EXIT_FAILURE);
+  }
+  for (i=n-1; i>=0; i--) {
+    b[i].nextfree = pktfree;
+    pktfree = &b[i];
+  }
+  poolblocks++;
+  if (len != NULL)
+    *len = n * sizeof(struct pktbuf);
+  return b;
+}
+
+struct pkt *newpkt(void)
+{
+  struct pktbuf *b;
+
+  if (pktfree == NULL)
+    growpool(PKTCHUNK, NULL);
+  b = pktfree;
+  pktfree = b->nextfree;
+  b->refcount = 1;
+  return &b->pkt;
+}
+
+const struct pkt *holdpkt(const struct pkt *packet)
+{
+  ((struct pktbuf *)packet)->refcount++;
+  return packet;
+}
+
+void releasepkt(const struct pkt *packet)
+{
+  struct pktbuf *b = (struct pktbuf *)packet;
+
+  if (--b->refcount == 0) {
+    b->nextfree = pktfree;
+    pktfree = b;
+  }
+}
+
+/************************** TOLAYER3 ***************/
+void tolayer3(int AorB, struct pkt packet)
+/* A or B is sending to network  */
+{
+  struct pkt *mypktptr = newpkt();
+
+  *mypktptr = packet;
+  tolayer3ref(AorB, mypktptr);
+  releasepkt(mypktptr);
+}
+
+/************************** FRAMING ****************/
+int appendmsg(struct pkt *packet, const struct msg *message)
+{
+  int i;
+
+  if (packet->length + MSGHDRSIZE + MSGSIZE > mtu)
+    return 0;
+  packet->payload[packet->length++] = MSGSIZE;
+  for (i=0; i<MSGSIZE; i++)
+    packet->payload[packet->length++] = message->data[i];
+  return 1;
+}
+
+void tolayer5n(int AorB, const struct pkt *packet)
+{
+  const char *payload = packet->payload;
+  int i, n, length = packet->length;
+
+  /* split the payload back into the messages appendmsg() framed */
+  for (i=0; i+MSGHDRSIZE <= length; i+=MSGHDRSIZE+n) {
+    n = (unsigned char)payload[i];
+    if (i+MSGHDRSIZE+n > length) {
+      printf("Warning: message framing overruns packet payload.\n");
+      return;
+    }
+    deliver(AorB, packet, payload+i+MSGHDRSIZE, n);
+  }
+}
+
+void tolayer5(int AorB, const char datasent[MSGSIZE])
+{
+  deliver(AorB, NULL, datasent, MSGSIZE);
+}
+
+/************************** SNAPSHOTS **************/
+static void badsnapshot(void)
+{
+  printf("snapshot is truncated or damaged\n");
+  exit(EXIT_FAILURE);
+}
+
+/* zigzag encoded, seven bits a byte, low bits first */
+void saveint(FILE *f, long v)
+{
+  unsigned long u = v < 0 ? ~((unsigned long)v << 1) : (unsigned long)v << 1;
+
+  while (u >= 0x80) {
+    putc((int)(u & 0x7f) | 0x80, f);
+    u >>= 7;
+  }
+  putc((int)u, f);
+}
+
+long loadint(FILE *f)
+{
+  unsigned long u = 0;
+  int c, shift = 0;
+
+  do {
+    if ((c = getc(f)) == EOF || shift >= (int)(8 * sizeof(u)))
+      badsnapshot();
+    u |= (unsigned long)(c & 0x7f) << shift;
+    shift += 7;
+  } while (c & 0x80);
+  return u & 1 ? (long)~(u >> 1) : (long)(u >> 1);
+}
+
+void savedouble(FILE *f, double d)
+{
+  fwrite(&d, sizeof(d), 1, f);
+}
+
+double loaddouble(FILE *f)
+{
+  double d;
+
+  if (fread(&d, sizeof(d), 1, f) != 1)
+    badsnapshot();
+  return d;
+}
+
+void savepkt(FILE *f, const struct pkt *packet)
+{
+  if (packet == NULL) {
+    saveint(f, -1);
+    return;
+  }
+  saveint(f, packet->length);
+  saveint(f, packet->seqnum);
+  saveint(f, packet->acknum);
+  saveint(f, packet->checksum);
+  fwrite(packet->payload, 1, packet->length, f);
+}
+
+struct pkt *loadpkt(FILE *f)
+{
+  struct pkt *packet;
+  long length = loadint(f);
+
+  if (length < 0)
+    return NULL;
+  if (length > MAXPAYLOAD)
+    badsnapshot();
+  packet = newpkt();
+  packet->length = length;
+  packet->seqnum = loadint(f);
+  packet->acknum = loadint(f);
+  packet->checksum = loadint(f);
+  if (fread(packet->payload, 1, length, f) != (size_t)length)
+    badsnapshot();
+  return packet;
+}
+
+/************************** SETTINGS ***************/
+/* find a protocol engine by name, NULL if there is none */
+const struct protocol *findprotocol(const char *name)
+{
+  int i;
+
+  for (i=0; engines[i]!=NULL; i++)
+    if (strcmp(name, engines[i]->name) == 0)
+      return engines[i];
+  return NULL;
+}
+
+/* consume argv[*i] (and its value) if it is one of the shared settings */
+int settingarg(int argc, char **argv, int *i)
+{
+  if (*i+1 >= argc)
+    return 0;
+  if (strcmp(argv[*i], "-m") == 0)
+    mtu = atoi(argv[++*i]);
+  else if (strcmp(argv[*i], "-f") == 0)
+    flushdelay = atof(argv[++*i]);
+  else if (strcmp(argv[*i], "-k") == 0)
+    fecgroup = atoi(argv[++*i]);
+  else if (strcmp(argv[*i], "-w") == 0)
+    window = atoi(argv[++*i]);
+  else if (strcmp(argv[*i], "-q") == 0)
+    seqspace = atoi(argv[++*i]);
+  else if (strcmp(argv[*i], "-b") == 0)
+    recvbuffer = atol(argv[++*i]);
+  else if (strcmp(argv[*i], "-B") == 0) {
+    ++*i;
+    if (strcmp(argv[*i], "drop") == 0)
+      advertise = 0;
+    else if (strcmp(argv[*i], "advertise") == 0)
+      advertise = 1;
+    else {
+      printf("the receive buffer policy may be drop or advertise\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  else
+    return 0;
+  return 1;
+}
+
+/* exit with a message if the shared settings do not make sense */
+void checksettings(void)
+{
+  if (mtu < MSGHDRSIZE + MSGSIZE || mtu > MAXPAYLOAD) {
+    printf("mtu must be between %d and %d bytes\n", MSGHDRSIZE + MSGSIZE, MAXPAYLOAD);
+    exit(EXIT_FAILURE);
+  }
+  if (fecgroup < 0) {
+    printf("FEC group size must not be negative\n");
+    exit(EXIT_FAILURE);
+  }
+  if (fecgroup > 0 && mtu > MAXPAYLOAD - FECHDRSIZE) {
+    printf("with FEC the mtu may be at most %d bytes\n", MAXPAYLOAD - FECHDRSIZE);
+    exit(EXIT_FAILURE);
+  }
+  if (window < 0 || window >= MAXSEQSPACE || seqspace < 0 || seqspace > MAXSEQSPACE) {
+    printf("the window must be below and the sequence space at most %d\n", MAXSEQSPACE);
+    exit(EXIT_FAILURE);
+  }
+  if (recvbuffer < 0) {
+    printf("the receive buffer cap must not be negative\n");
+    exit(EXIT_FAILURE);
+  }
+  if (recvbuffer > 0 && recvbuffer < fecgroup * pktbufsize) {
+    printf("the receive buffer must hold the %d packets kept for FEC (%ld bytes)\n",
+           fecgroup, fecgroup * pktbufsize);
+    exit(EXIT_FAILURE);
+  }
+  if (flushdelay < 0.0) {
+    printf("flush delay must not be negative\n");
+    exit(EXIT_FAILURE);
+  }
+}
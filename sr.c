@@ -1,8 +1,9 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include "emulator.h"
-#include "gbn.h"
+#include "sr.h"
 
 /* ******************************************************************
    Go Back N protocol.  Adapted from J.F.Kurose
@@ -20,6 +21,11 @@
    - removed bidirectional GBN code and other code not used by prac.
    - fixed C style to adhere to current programming style
    - added GBN implementation
+   - the window and sequence space may be set with -w and -q; the hot
+   routines are kernels (see emulator.h), with the generic instance only
+   - the receiver hands in-order packets straight to layer 5 and holds
+   only out-of-order ones and those FEC needs, up to the memory set
+   with -b (see Receiver)
 **********************************************************************/
 
 #define RTT  16.0       /* round trip time.  MUST BE SET TO 16.0 when submitting assignment */
@@ -27,90 +33,188 @@
                           MUST BE SET TO 6 when submitting assignment */
 #define SEQSPACE 13    /* the min sequence space for GBN must be at least windowsize + 1 */
 #define NOTINUSE (-1)   /* used to fill header fields that are not being used */
+#define PARITY (-2)     /* acknum of an FEC parity packet, its seqnum is the first packet covered */
 /* extern float time; */
 /* generic procedure to compute the checksum of a packet.  Used by both sender and receiver
    the simulator will overwrite part of your packet with 'z's.  It will not overwrite your
    original checksum.  This procedure must generate a different checksum to the original if
    the packet is corrupted.
 */
-int ComputeChecksum(struct pkt packet)
+static int ComputeChecksum(const struct pkt *packet)
 {
   int checksum = 0;
   int i;
 
-  checksum = packet.seqnum;
-  checksum += packet.acknum;
-  for ( i=0; i<20; i++ )
-    checksum += (int)(packet.payload[i]);
+  checksum = packet->seqnum;
+  checksum += packet->acknum;
+  checksum += packet->length;
+  for ( i=0; i<packet->length; i++ )
+    checksum += (int)(packet->payload[i]);
 
   return checksum;
 }
 
-bool IsCorrupted(struct pkt packet)
+static bool IsCorrupted(const struct pkt *packet)
 {
-  if (packet.checksum == ComputeChecksum(packet))
+  if (packet->length < 0 || packet->length > MAXPAYLOAD)
+    return (true);
+  if (packet->checksum == ComputeChecksum(packet))
     return (false);
   else
     return (true);
 }
 
 
+static int winsize, seqsize;            /* window and sequence space of the run */
+static int maxheld;                     /* packets B may hold out of order */
+static void choosekernel(void);
+
+
 /********* Sender (A) variables and functions ************/
 
-static struct pkt buffer[SEQSPACE];     /* array for storing packets waiting for ACK */
-static bool acked [SEQSPACE];           /* mark whether each packet in window is acked */
+static const struct pkt *buffer[MAXSEQSPACE]; /* packets waiting for ACK, shared with layer 3 */
+static bool acked [MAXSEQSPACE];        /* mark whether each packet in window is acked */
 static int base;                        /* base of the window */
 static int nextseqnum;                  /* sequence number for next packet to send */
 
-/* called from layer 5 (application layer), passed the message to be sent to other side */
-void A_output(struct msg message)
-{   
-    int i;
-    struct pkt sendpkt;
-    /* put message into local buffer first */
-    if ( (nextseqnum + SEQSPACE - base) % SEQSPACE >= WINDOWSIZE ) {
+static struct pkt *pending;              /* packet collecting messages, not yet sent */
+static bool flushdue;                   /* pending packet has waited flushdelay */
+static bool flushtimer;                 /* flush timer is running */
+static struct pkt *parity;              /* XOR of the packets sent in the current FEC group */
+static int paritycount;                 /* number of packets covered by parity so far */
+static int recvedge;                    /* first seqnum B has no room for, -1 if unknown */
+
+/* fold a newly sent packet into the current parity packet, and send the
+   parity once it covers fecgroup packets.  The first FECHDRSIZE bytes of
+   the parity payload hold the XOR of the lengths, then the XOR of payloads */
+static void AddToParity(const struct pkt *sendpkt)
+{
+    int i, len;
+
+    if (paritycount == 0) {
+        parity = newpkt();
+        parity->seqnum = sendpkt->seqnum;
+        parity->acknum = PARITY;
+        parity->length = FECHDRSIZE;
+        memset(parity->payload, 0, FECHDRSIZE + mtu);
+    }
+    len = ((unsigned char)parity->payload[0] << 8) | (unsigned char)parity->payload[1];
+    len ^= sendpkt->length;
+    parity->payload[0] = (char)(len >> 8);
+    parity->payload[1] = (char)(len & 0xff);
+    for (i = 0; i < sendpkt->length; i++)
+        parity->payload[FECHDRSIZE + i] ^= sendpkt->payload[i];
+    if (FECHDRSIZE + sendpkt->length > parity->length)
+        parity->length = FECHDRSIZE + sendpkt->length;
+
+    if (++paritycount == fecgroup) {
+        parity->checksum = ComputeChecksum(parity);
         if (TRACE > 0)
-            printf("----A: New message arrives, send window is full\n");
-        window_full++;
-        return;
+            printf("Sending parity for packets %d..%d to layer 3\n",
+                   parity->seqnum, (parity->seqnum + fecgroup - 1) % seqsize);
+        tolayer3ref(A, parity);
+        releasepkt(parity);
+        parity = NULL;
+        paritycount = 0;
+        parity_sent++;
     }
-    if (TRACE > 1)
-        printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
-    
-    /* make a packet */
-    sendpkt.seqnum = nextseqnum;
-    sendpkt.acknum = NOTINUSE;
-    for (i = 0; i < 20; ++i)
-        sendpkt.payload[i] = message.data[i];
-    sendpkt.checksum = ComputeChecksum(sendpkt);
+}
+
+/* true if there is no room in the window W for another packet, or
+   no room for it at B as B last advertised */
+KERNEL bool WindowFull(int W, int S)
+{
+    return SEQDIST(base, nextseqnum, S) >= W || nextseqnum == recvedge;
+}
+
+/* true if the pending packet should go out as soon as the window allows */
+static bool PendingReady(void)
+{
+    return flushdue || pending->length + MSGHDRSIZE + MSGSIZE > mtu;
+}
+
+/* number the pending packet and send it; the window must have room */
+KERNEL void SendPending(int S)
+{
+    struct pkt *sendpkt = pending;
+
+    pending = NULL;
+    flushdue = false;
+    if (flushtimer) {
+        stopflushtimer(A);
+        flushtimer = false;
+    }
+
+    sendpkt->seqnum = nextseqnum;
+    sendpkt->acknum = NOTINUSE;
+    sendpkt->checksum = ComputeChecksum(sendpkt);
 
     /* send to layer 3 */
     if (TRACE > 0)
-        printf("Sending packet %d to layer 3\n", sendpkt.seqnum);
-    tolayer3(A, sendpkt);
+        printf("Sending packet %d to layer 3\n", sendpkt->seqnum);
+    tolayer3ref(A, sendpkt);
 
+    /* keep the reference from newpkt() for retransmission */
     buffer[nextseqnum] = sendpkt;
     acked [nextseqnum] = false;
+
+    if (fecgroup > 0)
+        AddToParity(sendpkt);
     
     /* start timer if it is the first package */
     if (base == nextseqnum)
         starttimer(A, RTT);
 
-    nextseqnum = (nextseqnum + 1) % SEQSPACE;
+    nextseqnum = SEQNEXT(nextseqnum, S);
+}
+
+/* called from layer 5 (application layer), passed the message to be sent to other side */
+KERNEL void A_outputk(const struct msg *message, int W, int S)
+{   
+    /* coalesce with messages already waiting if the packet has room */
+    if (pending != NULL && appendmsg(pending, message)) {
+        if (TRACE > 1)
+            printf("----A: New message arrives, added to pending packet\n");
+    } else if (WindowFull(W, S)) {
+        if (TRACE > 0)
+            printf("----A: New message arrives, send window is full\n");
+        window_full++;
+        return;
+    } else {
+        if (TRACE > 1)
+            printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
+        /* a full pending packet goes first */
+        if (pending != NULL)
+            SendPending(S);
+
+        /* put message into a new packet */
+        pending = newpkt();
+        pending->length = 0;
+        appendmsg(pending, message);
+        if (flushdelay > 0.0) {
+            startflushtimer(A, flushdelay);
+            flushtimer = true;
+        } else
+            flushdue = true;
+    }
+
+    if (PendingReady() && !WindowFull(W, S))
+        SendPending(S);
 }
 
 
 /* called from layer 3, when a packet arrives for layer 4
    In this practical this will always be an ACK as B never sends data.
 */
-void A_input(struct pkt packet)
+KERNEL void A_inputk(const struct pkt *packet, int W, int S)
 {   
-    int ack = packet.acknum;
-    int diff = (ack - base + SEQSPACE) % SEQSPACE;
-    int old_base;
+    int ack = packet->acknum;
+    int diff;
+    int old_base = base;
+    int old_edge = recvedge;
 
     /* Filtering emulator corruption */
-    if (IsCorrupted(packet) || ack < 0 || ack >= SEQSPACE) {
+    if (IsCorrupted(packet) || ack < 0 || ack >= S) {
         if (TRACE > 0)
             printf("----A: corrupted ACK is received, do nothing!\n");
         return; 
@@ -118,103 +222,297 @@ void A_input(struct pkt packet)
     
     if (TRACE > 0) printf("----A: uncorrupted ACK %d is received\n", ack);
     total_ACKs_received++;
-
-    if (diff >= WINDOWSIZE) {
-        return;  /* already marked ACK, do nothing */
-    }
+    if (advertise && packet->seqnum >= 0 && packet->seqnum < S)
+        recvedge = packet->seqnum;
 
     /*  ignore ACK if it is not in window */
+    diff = SEQDIST(base, ack, S);
+    if (diff < W) {
+        /* mark the seq as confirmed */
+        if (!acked[ack]) {
+            if (TRACE > 0) printf("----A: ACK %d is not a duplicate\n", ack);
+            new_ACKs++;
+            acked[ack] = true;
+        } else {
+            if (TRACE > 0)
+                printf ("----A: duplicate ACK received, do nothing!\n");
+        }
 
-    /* mark the seq as confirmed */
-    if (!acked[ack]) {
-        if (TRACE > 0) printf("----A: ACK %d is not a duplicate\n", ack);
-        new_ACKs++;
-        acked[ack] = true;
-    } else {
-        if (TRACE > 0)
-            printf ("----A: duplicate ACK received, do nothing!\n");
-    }
+        /* sliding until the first position which is not ACK */
+        while (acked[base]) {
+            acked[base] = false;
+            releasepkt(buffer[base]);
+            buffer[base] = NULL;
+            base = SEQNEXT(base, S);
+        }
 
-    /* sliding until the first position which is not ACK */
-    old_base = base;
-    while (acked[base]) {
-        acked[base] = false;
-        base = (base + 1) % SEQSPACE;
+        /* reset timer if sliding happened */
+        if (old_base != base) {
+            stoptimer(A);
+            if (base != nextseqnum)
+                starttimer(A, RTT);
+        }
     }
 
-    /* reset timer if sliding happened */
-    if (old_base != base) {
-        stoptimer(A);
-        if (base != nextseqnum)
-            starttimer(A, RTT);
-    }
+    /* the window has opened, a waiting packet can go */
+    if ((old_base != base || old_edge != recvedge)
+        && pending != NULL && PendingReady() && !WindowFull(W, S))
+        SendPending(S);
 }
 
 
 /* called when A's timer goes off */
-void A_timerinterrupt(void)
+static void A_timerinterrupt(void)
 {   
     if (TRACE > 0){
         printf("----A: time out,resend packets!\n");
-        printf("---A: resending packet %d\n", buffer[base].seqnum);
+        printf("---A: resending packet %d\n", buffer[base]->seqnum);
     }
 
-    tolayer3(A, buffer[base]);
+    tolayer3ref(A, buffer[base]);
     packets_resent++;
     starttimer(A, RTT);
 }
 
+/* called when A's flush timer goes off, the pending packet has waited long enough */
+static void A_flushinterrupt(void)
+{
+    flushtimer = false;
+    flushdue = true;
+    if (!WindowFull(winsize, seqsize))
+        SendPending(seqsize);
+}
+
 
 /* the following routine will be called once (only) before any other */
 /* entity A routines are called. You can use it to do any initialization */
-void A_init(void)
+static void A_init(void)
 {
     int i;
+
+    choosekernel();
     base = 0;
     nextseqnum = 0;
-    for (i = 0; i < SEQSPACE; i++) {
+    /* drop anything a previous run left behind */
+    if (pending != NULL)
+        releasepkt(pending);
+    if (parity != NULL)
+        releasepkt(parity);
+    pending = NULL;
+    flushdue = false;
+    flushtimer = false;
+    parity = NULL;
+    paritycount = 0;
+    /* as if B had advertised its room before the first packet */
+    recvedge = advertise ? (maxheld + 1) % seqsize : -1;
+    if (fecgroup > winsize) {
+        printf("FEC group size may be at most the window size (%d)\n", winsize);
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < MAXSEQSPACE; i++) {
         acked[i] = false;
+        if (buffer[i] != NULL)
+            releasepkt(buffer[i]);
+        buffer[i] = NULL;
     }
 }
 
 
 /********* Receiver (B)  variables and procedures ************/
 
-static struct pkt recv_buffer[SEQSPACE]; /* buffer to store received packets */
-static bool received[SEQSPACE];          /* mark if a packet has been received */
+/* Packets that arrive out of order are held by reference in a ring of
+   winsize + fecgroup slots, indexed by their distance from expected_base:
+   slot head is expected_base itself, which is never held as an in-order
+   packet goes straight to layer 5, the next winsize - 1 slots are the rest
+   of the window, and the fecgroup slots behind head keep the packets last
+   delivered for parity to rebuild a neighbour from.  Each packet held,
+   out of order or kept for parity, pins one pool buffer, and -b counts
+   whole buffers (pktbufsize bytes) whatever the packet's length.  The
+   fecgroup kept for parity come off the cap first; at most maxheld of
+   the rest are held out of order, and one arriving when that many are
+   dropped without an ACK.  With advertise each ACK carries in its
+   seqnum the first sequence number B has no room for. */
+static const struct pkt **ring;         /* the held packets, NULL where none */
+static int nslots;                      /* slots in the ring */
+static int head;                        /* slot of expected_base */
+static int held;                        /* packets held out of order */
+static int kept;                        /* delivered packets kept for parity */
 static int expected_base = 0;                /* the next seqnum expected to be delivered */
-/* called from layer 3, when a packet arrives for layer 4 at B*/
-void B_input(struct pkt packet)
+
+/* B has taken another buffer */
+static void NotePeak(void)
 {
-    struct pkt ack_pkt;
-    int seq = packet.seqnum;
-    int i;
-    bool corrupted = IsCorrupted(packet);
-    int distance = (seq - expected_base + SEQSPACE) % SEQSPACE;
-    /* Always ACK the received packet, even if corrupted or duplicate */
-    ack_pkt.seqnum = 0;
-    /* Filtering corruption pkg */
-    if (seq < 0 || seq >= SEQSPACE) {
-        return;
+    if ((held + kept) * pktbufsize > recv_peak)
+        recv_peak = (held + kept) * pktbufsize;
+}
+
+/* the packet held for seq, NULL if there is none */
+static const struct pkt *HeldPacket(int seq)
+{
+    int ahead = SEQDIST(expected_base, seq, seqsize);
+    int behind = seqsize - ahead;
+    int slot;
+
+    if (ahead < winsize)
+        slot = head + ahead;
+    else if (behind <= fecgroup)
+        slot = head + nslots - behind;
+    else
+        return NULL;
+    return ring[slot >= nslots ? slot - nslots : slot];
+}
+
+/* expected_base has been delivered: move on, and free the slot at the new
+   end of the window, which kept the oldest packet delivered */
+KERNEL void AdvanceWindow(int W, int S)
+{
+    int slot = head + W;
+
+    if (slot >= nslots)
+        slot -= nslots;
+    if (ring[slot] != NULL) {
+        releasepkt(ring[slot]);
+        kept--;
     }
-    for (i = 0; i < 20; i++) ack_pkt.payload[i] = '0';
-    /* printf("corrupted: %d, seq: %d, expected_base: %d, SEQSPACE: %d, distance: %d\n", corrupted, seq, expected_base, SEQSPACE, distance); */
-    if (!corrupted && distance < WINDOWSIZE) {
-        if (!received[seq]) {
-            recv_buffer[seq] = packet;
-            received[seq] = true;
+    ring[slot] = NULL;
+    head = head + 1 == nslots ? 0 : head + 1;
+    expected_base = SEQNEXT(expected_base, S);
+}
+
+/* deliver an in-window packet if it is next, with whatever it completes,
+   or hold it for later.  False if it had to be dropped for want of room */
+KERNEL bool AcceptPacket(const struct pkt *packet, int W, int S)
+{
+    int ahead = SEQDIST(expected_base, packet->seqnum, S);
+    int slot = head + ahead;
+    const struct pkt *next;
+
+    if (ahead > 0) {
+        if (slot >= nslots)
+            slot -= nslots;
+        if (ring[slot] == NULL) {
+            if (held == maxheld) {
+                if (TRACE > 0)
+                    printf("----B: no room for packet %d, dropped\n", packet->seqnum);
+                recv_dropped++;
+                return false;
+            }
+            ring[slot] = holdpkt(packet);
+            held++;
+            NotePeak();
         }
+        return true;
+    }
+
+    /* in order: straight to layer 5, kept only while FEC may need it */
+    tolayer5n(B, packet);
+    if (fecgroup > 0) {
+        ring[head] = holdpkt(packet);
+        kept++;
+    }
+    AdvanceWindow(W, S);          /* which lets go of the oldest kept */
+    NotePeak();
+    while ((next = ring[head]) != NULL) {
+        tolayer5n(B, next);
+        held--;
+        if (fecgroup > 0)
+            kept++;
+        else {
+            releasepkt(next);
+            ring[head] = NULL;
+        }
+        AdvanceWindow(W, S);
+    }
+    return true;
+}
+
+/* send an ACK for seq to A */
+static void SendACK(int seq)
+{
+    struct pkt *ack_pkt;
+
+    ack_pkt = newpkt();
+    ack_pkt->seqnum = advertise ? (expected_base + maxheld + 1) % seqsize : 0;
+    ack_pkt->acknum = seq;
+    ack_pkt->length = 0;
+    ack_pkt->checksum = ComputeChecksum(ack_pkt);
+    tolayer3ref(B, ack_pkt);
+    releasepkt(ack_pkt);
+}
 
-        /* deliver in-order */
-        while (received[expected_base]) {
-            tolayer5(B, recv_buffer[expected_base].payload);
-            received[expected_base] = false;
-            expected_base = (expected_base + 1) % SEQSPACE;
+/* rebuild the one missing packet of the group a parity packet covers.
+   The group was sent just before its parity, so each member is either
+   still ahead of expected_base (present if received) or was delivered
+   within the last fecgroup packets and is still held in the ring */
+static void RecoverFromParity(const struct pkt *parity)
+{
+    const struct pkt *member;
+    struct pkt *rebuilt;
+    int missing = -1;
+    int i, j, seq, len;
+
+    for (i = 0; i < fecgroup; i++) {
+        seq = (parity->seqnum + i) % seqsize;
+        if (HeldPacket(seq) == NULL) {
+            if (missing >= 0)
+                return;   /* more than one lost, parity cannot help */
+            missing = seq;
         }
-        ack_pkt.acknum = seq;
-    } else if (!corrupted && distance >= SEQSPACE - WINDOWSIZE) {
-        /* past packet */
-        ack_pkt.acknum = seq;  /*  do not receive but send ack */
+    }
+    if (missing < 0 || SEQDIST(expected_base, missing, seqsize) >= winsize)
+        return;
+
+    rebuilt = newpkt();
+    len = ((unsigned char)parity->payload[0] << 8) | (unsigned char)parity->payload[1];
+    memcpy(rebuilt->payload, parity->payload + FECHDRSIZE, parity->length - FECHDRSIZE);
+    for (i = 0; i < fecgroup; i++) {
+        seq = (parity->seqnum + i) % seqsize;
+        if (seq == missing)
+            continue;
+        member = HeldPacket(seq);
+        len ^= member->length;
+        for (j = 0; j < member->length; j++)
+            rebuilt->payload[j] ^= member->payload[j];
+    }
+    if (len < 0 || len > parity->length - FECHDRSIZE) {
+        releasepkt(rebuilt);
+        return;
+    }
+    rebuilt->seqnum = missing;
+    rebuilt->acknum = NOTINUSE;
+    rebuilt->length = len;
+    rebuilt->checksum = ComputeChecksum(rebuilt);
+
+    if (TRACE > 0)
+        printf("----B: packet %d is rebuilt from parity, send ACK!\n", missing);
+    packets_recovered++;
+    if (AcceptPacket(rebuilt, winsize, seqsize))
+        SendACK(missing);
+    releasepkt(rebuilt);
+}
+
+/* called from layer 3, when a packet arrives for layer 4 at B*/
+KERNEL void B_inputk(const struct pkt *packet, int W, int S)
+{
+    int seq = packet->seqnum;
+    bool corrupted;
+    int distance;
+    /* Filtering corruption pkg */
+    if (seq < 0 || seq >= S) {
+        return;
+    }
+    corrupted = IsCorrupted(packet);
+    distance = SEQDIST(expected_base, seq, S);
+    /* parity packets are never ACKed, they only repair their group */
+    if (!corrupted && packet->acknum == PARITY) {
+        RecoverFromParity(packet);
+        return;
+    }
+    if (!corrupted && distance < W) {
+        if (!AcceptPacket(packet, W, S))
+            return;
+    } else if (!corrupted && distance >= S - W) {
+        /* past packet, do not receive but send ack */
     } else {
         /* If corrupted or duplicate/invalid, do nothing */
         return;
@@ -224,20 +522,35 @@ void B_input(struct pkt packet)
     }
 
     packets_received++;
-    ack_pkt.checksum = ComputeChecksum(ack_pkt);
-    tolayer3(B, ack_pkt);
+
+    /* Always ACK the received packet, even if duplicate */
+    SendACK(seq);
 }
 
 
 /* the following routine will be called once (only) before any other */
 /* entity B routines are called. You can use it to do any initialization */
-void B_init(void)
+static void B_init(void)
 {
     int i;
-    expected_base = 0;
-    for (i = 0; i < SEQSPACE; i++) {
-        received[i] = false;
+
+    /* drop anything a previous run left behind */
+    for (i = 0; i < nslots; i++)
+        if (ring[i] != NULL)
+            releasepkt(ring[i]);
+    choosekernel();
+    nslots = winsize + fecgroup;
+    ring = realloc(ring, nslots * sizeof(*ring));
+    if (ring == NULL) {
+        printf("memory allocation for the receive buffer failed.\n");
+        exit(EXIT_FAILURE);
     }
+    for (i = 0; i < nslots; i++)
+        ring[i] = NULL;
+    head = 0;
+    held = 0;
+    kept = 0;
+    expected_base = 0;
 }
 
 /******************************************************************************
@@ -245,11 +558,138 @@ void B_init(void)
  *****************************************************************************/
 
 /* Note that with simplex transfer from a-to-B, there is no B_output() */
-void B_output(struct msg message)
+static void B_output(const struct msg *message)
 {
 }
 
 /* called when B's timer goes off */
-void B_timerinterrupt(void)
+static void B_timerinterrupt(void)
+{
+}
+
+/* called when B's flush timer goes off */
+static void B_flushinterrupt(void)
+{
+}
+
+/************************** KERNEL INSTANCES *******/
+/* only the generic instance: -M shows no steady gain for a constant */
+/* one, at the default sizes or with a large power of two space      */
+#define INSTANCE(name, W, S) \
+    static void name##_A_output(const struct msg *message) { A_outputk(message, W, S); } \
+    static void name##_A_input(const struct pkt *packet) { A_inputk(packet, W, S); } \
+    static void name##_B_input(const struct pkt *packet) { B_inputk(packet, W, S); }
+#define ENTRY(name, W, S) { W, S, name##_A_output, name##_A_input, name##_B_input }
+
+INSTANCE(generic, winsize, seqsize)
+
+struct kernel {
+    int window, seqspace;                /* window 0 for any */
+    void (*A_output)(const struct msg *);
+    void (*A_input)(const struct pkt *);
+    void (*B_input)(const struct pkt *);
+};
+
+static const struct kernel kernels[] = {
+    ENTRY(generic, 0, 0)
+};
+static const struct kernel *kernel = &kernels[0];   /* instance for the run */
+
+/* size the window and sequence space from the settings and pick the */
+/* instance for them.  Selective repeat needs twice the window.      */
+static void choosekernel(void)
+{
+    winsize = window > 0 ? window : WINDOWSIZE;
+    seqsize = seqspace > 0 ? seqspace : window > 0 ? 2 * window : SEQSPACE;
+    if (seqsize < 2 * winsize) {
+        printf("sr needs a sequence space of at least twice the window (%d)\n", 2 * winsize);
+        exit(EXIT_FAILURE);
+    }
+    maxheld = winsize - 1;
+    if (recvbuffer > 0 && recvbuffer / pktbufsize - fecgroup < maxheld)
+        maxheld = (int)(recvbuffer / pktbufsize - fecgroup);
+    for (kernel = kernels; kernel->seqspace != 0; kernel++)
+        if (!generickernels && kernel->seqspace == seqsize
+            && (kernel->window == 0 || kernel->window == winsize))
+            break;
+}
+
+static void A_output(const struct msg *message)
+{
+    kernel->A_output(message);
+}
+
+static void A_input(const struct pkt *packet)
+{
+    kernel->A_input(packet);
+}
+
+static void B_input(const struct pkt *packet)
+{
+    kernel->B_input(packet);
+}
+
+/* write A's window and FEC group and B's receive buffer to a snapshot */
+static void save(FILE *f)
+{
+    int i;
+
+    for (i = 0; i < seqsize; i++) {
+        savepkt(f, buffer[i]);
+        saveint(f, acked[i]);
+    }
+    /* the ring from expected_base on, so it comes back with head 0 */
+    for (i = 0; i < nslots; i++)
+        savepkt(f, ring[(head + i) % nslots]);
+    saveint(f, recvedge);
+    saveint(f, base);
+    saveint(f, nextseqnum);
+    savepkt(f, pending);
+    saveint(f, flushdue);
+    saveint(f, flushtimer);
+    savepkt(f, parity);
+    saveint(f, paritycount);
+    saveint(f, expected_base);
+}
+
+/* read back what save() wrote; A_init and B_init have just run */
+static void restore(FILE *f)
 {
+    int i;
+
+    for (i = 0; i < seqsize; i++) {
+        buffer[i] = loadpkt(f);
+        acked[i] = loadint(f);
+    }
+    for (i = 0; i < nslots; i++) {
+        ring[i] = loadpkt(f);
+        if (ring[i] != NULL && i > 0 && i < winsize)
+            held++;
+        else if (ring[i] != NULL && i >= winsize)
+            kept++;
+    }
+    recvedge = loadint(f);
+    base = loadint(f);
+    nextseqnum = loadint(f);
+    pending = loadpkt(f);
+    flushdue = loadint(f);
+    flushtimer = loadint(f);
+    parity = loadpkt(f);
+    paritycount = loadint(f);
+    expected_base = loadint(f);
 }
+
+/* the occupancy of A's window, packets acknowledged out of order */
+/* included, for the emulator's statistics                        */
+static int inflight(void)
+{
+    return SEQDIST(base, nextseqnum, seqsize);
+}
+
+/* the entry points the emulator calls when this protocol is selected */
+const struct protocol sr_protocol = {
+  "sr",
+  A_init, A_output, A_input, A_timerinterrupt, A_flushinterrupt,
+  B_init, B_output, B_input, B_timerinterrupt, B_flushinterrupt,
+  save, restore, inflight
+};
@@ -0,0 +1,821 @@
+/* ******************************************************************
+   UDP TRANSPORT BACKEND
+
+   Runs the same protocol engines as the emulator, but over real UDP
+   sockets on the loopback interface instead of the simulated channel:
+   - tolayer3ref() queues a packet for its entity's socket; each queue
+   goes out with one sendmmsg() per pass of the event loop (or when it
+   fills up), header and payload gathered straight from the pool buffer
+   - arriving packets are read in batches with recvmmsg() directly into
+   pool buffers and handed to the entity's input routine
+   - the retransmission and flush timers of each entity are timerfds;
+   one time unit (RTT, lambda, flush delay) is -u microseconds.  While
+   a recvmmsg() batch is handed to an entity its timer starts and stops
+   are only noted, and each timer changed is set once after the batch
+   - an epoll loop waits on the two sockets, the four timers and the
+   layer 5 message source
+   - an optional impairment shim applies the emulator's loss and
+   corruption models before packets reach the socket: -L and -C give
+   the probabilities, -D limits them to one direction as the emulator's
+   direction setting does, and a corrupted packet is damaged the same
+   way (payload, sequence or ACK number)
+
+   With -U the sockets and timers are driven through io_uring instead
+   (see uring.c): receives stay posted on both sockets, sends and
+   receives use the pool memory registered as a fixed buffer, the
+   entity timers are timeout requests on the ring, and each pass of the
+   event loop is a single io_uring_enter() call.  The report then
+   goes out through an io_uring stream as well, whose writes are
+   counted on a last line once it is closed; trace lines stay on stdio,
+   where the protocol routines print theirs.  If the kernel does not
+   offer io_uring the epoll loop is used.
+
+   A packet goes on the wire as the struct pkt header followed by its
+   payload; both ends are on the same host.  Each message carries the
+   time it was generated, so the receiving side can measure per-message
+   latency.  Linux only; build with
+     gcc -O2 -o udp udp.c uring.c packet.c gbn.c sr.c
+   ****************************************************************** */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include "emulator.h"
+#include "uring.h"
+
+#define  BATCH      64   /* packets per sendmmsg/recvmmsg call */
+#define  HDRSIZE    ((int)offsetof(struct pkt, payload))  /* header on the wire */
+#define  NRECV      32   /* receives kept posted per socket with io_uring */
+#define  POOLSIZE   1024 /* pool buffers registered with io_uring */
+
+/* timers of an entity */
+#define  RTTIMER     0
+#define  FLUSHTIMER  1
+
+/* what an epoll event refers to, combined with the entity */
+#define  EV_SOCKET   0
+#define  EV_TIMER    1
+#define  EV_SOURCE   2
+#define  EVTAG(kind, AorB, n)  (((kind) << 16) | ((n) << 8) | (AorB))
+
+/* what an io_uring completion refers to: a packet pointer or a timer */
+/* number, with the kind in the low bits (pool buffers are aligned)   */
+#define  CQ_SEND     1
+#define  CQ_RECV     2          /* + AorB */
+#define  CQ_TIMER    4          /* timeout, with the timer and its generation */
+#define  CQ_SOURCE   5          /* read of the source timerfd */
+#define  CQ_REMOVE   6          /* timeout removal, nothing to do */
+#define  CQ_KIND     7
+#define  TIMERNO(AorB, which)  ((AorB) * 2 + (which))
+
+struct endpoint {
+  int sock;                              /* socket the entity receives on */
+  struct sockaddr_in peer;               /* where its packets are sent */
+  int timerfd[2];                        /* retransmission and flush timers */
+  int armed[2];
+  const struct pkt *outq[BATCH];         /* packets waiting for sendmmsg */
+  int nout;
+};
+
+static struct endpoint ends[2];
+static const struct protocol *proto;
+static int epfd;
+static int sourcefd;
+
+/* io_uring engine */
+static int useuring;
+static struct uring ring;
+static const char *region;       /* pool buffers registered as fixed buffer 0 */
+static size_t regionlen;
+static uint64_t ticks;           /* expirations read from the source timer */
+static struct __kernel_timespec timeouts[4];  /* per timer, until submitted */
+static uint32_t timergen[4];     /* generation of each timer's current timeout */
+
+/* settings */
+static long nsimmax = 100000;    /* number of messages to send */
+static double lambda = 0.0;      /* time between messages, 0 to saturate */
+static double usecperunit = 1000.0;
+static double lossprob = 0.0;
+static double corruptprob = 0.0;
+static int corruptdirection = 2; /* 0 A->B, 1 A<-B, 2 both ways */
+
+/* statistics */
+static long noffered;            /* messages layer 5 offered to the sender */
+static long nsim;                /* messages accepted by the sender */
+static long nrefused;            /* offers the sender turned away (saturating) */
+static long ntolayer3, nlost, ncorrupt;
+static long nsendcalls, nrecvcalls, nrecvpkts;
+static long nsyscalls;           /* system calls made by the event loop */
+static long nwrites;             /* system calls made by the output stream */
+static FILE *outfile;            /* the report: stdout or the io_uring stream */
+static long ntimercalls;         /* timer starts and stops */
+static long ntimersets;          /* timer updates made for them */
+static long messages_delivered, bytes_delivered;
+static double latencysum, latencymax;
+
+static int64_t nsecs(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static double jimsrand(void)
+{
+  return rand() / (double)RAND_MAX;
+}
+
+static void fail(const char *what)
+{
+  perror(what);
+  exit(EXIT_FAILURE);
+}
+
+/********************** TIMERS ************************/
+static uint64_t timertag(int no)
+{
+  return ((uint64_t)timergen[no] << 8) | (no << 3) | CQ_TIMER;
+}
+
+/* with io_uring a timer is a timeout request, and stopping it removes */
+/* the request; a timeout that completes under an older generation was */
+/* stopped or restarted in the meantime and is ignored                 */
+static void ringsettimer(int AorB, int which, int64_t ns)
+{
+  struct io_uring_sqe *sqe;
+  int no = TIMERNO(AorB, which);
+
+  if (ends[AorB].armed[which]) {
+    sqe = uring_sqe(&ring, IORING_OP_TIMEOUT_REMOVE, -1, CQ_REMOVE);
+    sqe->addr = timertag(no);
+  }
+  timergen[no]++;
+  if (ns > 0) {
+    timeouts[no].tv_sec = ns / 1000000000;
+    timeouts[no].tv_nsec = ns % 1000000000;
+    sqe = uring_sqe(&ring, IORING_OP_TIMEOUT, -1, timertag(no));
+    sqe->addr = (uintptr_t)&timeouts[no];
+    sqe->len = 1;
+  }
+}
+
+static void armtimer(int AorB, int which, double increment)
+{
+  struct itimerspec its;
+  int64_t ns = (int64_t)(increment * usecperunit * 1000.0);
+
+  ntimersets++;
+  memset(&its, 0, sizeof(its));
+  if (increment > 0.0 && ns == 0)
+    ns = 1;                       /* zero would disarm the timer */
+  if (useuring) {
+    ringsettimer(AorB, which, ns);
+    ends[AorB].armed[which] = increment > 0.0;
+    return;
+  }
+  its.it_value.tv_sec = ns / 1000000000;
+  its.it_value.tv_nsec = ns % 1000000000;
+  nsyscalls++;
+  if (timerfd_settime(ends[AorB].timerfd[which], 0, &its, NULL) < 0)
+    fail("timerfd_settime");
+  ends[AorB].armed[which] = increment > 0.0;
+}
+
+/* a batch of arriving packets is being handed to an entity: the timer */
+/* changes it makes wait in wanted[] for applytimers() at its end      */
+static int deferring;
+static double wanted[2][2];      /* increment, 0 to stop */
+static int changed[2][2];
+
+static void settimer(int AorB, int which, double increment)
+{
+  ntimercalls++;
+  if (!deferring) {
+    armtimer(AorB, which, increment);
+    return;
+  }
+  wanted[AorB][which] = increment;
+  changed[AorB][which] = 1;
+  ends[AorB].armed[which] = increment > 0.0;
+}
+
+/* set each timer changed during a batch to where it ended up */
+static void applytimers(void)
+{
+  int AorB, which;
+
+  deferring = 0;
+  for (AorB=A; AorB<=B; AorB++)
+    for (which=RTTIMER; which<=FLUSHTIMER; which++)
+      if (changed[AorB][which]) {
+        changed[AorB][which] = 0;
+        armtimer(AorB, which, wanted[AorB][which]);
+      }
+}
+
+void starttimer(int AorB, double increment)
+{
+  if (ends[AorB].armed[RTTIMER]) {
+    printf("Warning: attempt to start a timer that is already started\n");
+    return;
+  }
+  settimer(AorB, RTTIMER, increment);
+}
+
+void stoptimer(int AorB)
+{
+  if (!ends[AorB].armed[RTTIMER]) {
+    printf("Warning: unable to cancel your timer. It wasn't running.\n");
+    return;
+  }
+  settimer(AorB, RTTIMER, 0.0);
+}
+
+void startflushtimer(int AorB, double increment)
+{
+  if (ends[AorB].armed[FLUSHTIMER]) {
+    printf("Warning: attempt to start a timer that is already started\n");
+    return;
+  }
+  settimer(AorB, FLUSHTIMER, increment);
+}
+
+void stopflushtimer(int AorB)
+{
+  if (!ends[AorB].armed[FLUSHTIMER]) {
+    printf("Warning: unable to cancel your timer. It wasn't running.\n");
+    return;
+  }
+  settimer(AorB, FLUSHTIMER, 0.0);
+}
+
+/********************** SENDING ***********************/
+/* send everything queued at an entity with as few sendmmsg calls as possible */
+static void flushout(struct endpoint *e)
+{
+  struct mmsghdr msgs[BATCH];
+  struct iovec iov[BATCH];
+  int i, sent, n;
+
+  memset(msgs, 0, e->nout * sizeof(msgs[0]));
+  for (i=0; i<e->nout; i++) {
+    iov[i].iov_base = (void *)e->outq[i];
+    iov[i].iov_len = HDRSIZE + e->outq[i]->length;
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+  for (sent=0; sent<e->nout; sent+=n) {
+    n = sendmmsg(e->sock, msgs+sent, e->nout-sent, 0);
+    nsendcalls++;
+    nsyscalls++;
+    if (n < 0) {
+      if (errno == EINTR) {
+        n = 0;
+        continue;
+      }
+      if (errno != EAGAIN && errno != ENOBUFS)
+        fail("sendmmsg");
+      nlost += e->nout - sent;  /* socket buffer full: the packets are lost */
+      break;
+    }
+  }
+  for (i=0; i<e->nout; i++)
+    releasepkt(e->outq[i]);
+  e->nout = 0;
+}
+
+/* does the packet lie in the memory registered with io_uring? */
+static int registered(const struct pkt *packet)
+{
+  return (const char *)packet >= region
+    && (const char *)packet + sizeof(struct pkt) <= region + regionlen;
+}
+
+/* queue a send on the ring; the reference is dropped when it completes */
+static void ringsend(struct endpoint *e, const struct pkt *packet)
+{
+  struct io_uring_sqe *sqe;
+
+  if (registered(packet)) {
+    sqe = uring_sqe(&ring, IORING_OP_WRITE_FIXED, e->sock, (uintptr_t)packet | CQ_SEND);
+    sqe->buf_index = 0;
+  }
+  else
+    sqe = uring_sqe(&ring, IORING_OP_SEND, e->sock, (uintptr_t)packet | CQ_SEND);
+  sqe->addr = (uintptr_t)packet;
+  sqe->len = HDRSIZE + packet->length;
+}
+
+void tolayer3ref(int AorB, const struct pkt *packet)
+{
+  struct endpoint *e = &ends[AorB];
+  const struct pkt *out;
+  struct pkt *copy;
+  double x;
+  int impaired;
+
+  ntolayer3++;
+  impaired = corruptdirection == 2 || corruptdirection == AorB;
+  if (impaired && lossprob > 0.0 && jimsrand() < lossprob) {
+    nlost++;
+    if (TRACE>0)
+      printf("          TOLAYER3: packet being lost\n");
+    return;
+  }
+  if (!useuring && e->nout == BATCH)
+    flushout(e);
+  if (impaired && corruptprob > 0.0 && jimsrand() < corruptprob) {
+    ncorrupt++;
+    copy = newpkt();
+    *copy = *packet;
+    if ((x = jimsrand()) < .75 && copy->length > 0)
+      copy->payload[0]='Z';
+    else if (x < .875)
+      copy->seqnum = 999999;
+    else
+      copy->acknum = 999999;
+    if (TRACE>0)
+      printf("          TOLAYER3: packet being corrupted\n");
+    out = copy;
+  }
+  else
+    out = holdpkt(packet);
+  if (useuring)
+    ringsend(e, out);
+  else
+    e->outq[e->nout++] = out;
+}
+
+/********************** RECEIVING *********************/
+/* read a batch of packets arriving at A or B and hand them to the entity */
+static void receive(int AorB)
+{
+  static struct pkt *inpkt[BATCH];
+  struct mmsghdr msgs[BATCH];
+  struct iovec iov[BATCH];
+  int i, n;
+
+  memset(msgs, 0, sizeof(msgs));
+  for (i=0; i<BATCH; i++) {
+    if (inpkt[i] == NULL)
+      inpkt[i] = newpkt();
+    iov[i].iov_base = inpkt[i];
+    iov[i].iov_len = sizeof(struct pkt);
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+  n = recvmmsg(ends[AorB].sock, msgs, BATCH, MSG_DONTWAIT, NULL);
+  nrecvcalls++;
+  nsyscalls++;
+  if (n < 0) {
+    if (errno == EAGAIN || errno == EINTR)
+      return;
+    fail("recvmmsg");
+  }
+  nrecvpkts += n;
+  deferring = 1;
+  for (i=0; i<n; i++) {
+    if ((int)msgs[i].msg_len < HDRSIZE || (int)msgs[i].msg_len - HDRSIZE != inpkt[i]->length)
+      continue;                   /* truncated datagram, reuse the buffer */
+    if (AorB == A)
+      proto->A_input(inpkt[i]);
+    else
+      proto->B_input(inpkt[i]);
+    releasepkt(inpkt[i]);         /* the entity holds its own reference */
+    inpkt[i] = NULL;
+  }
+  applytimers();
+}
+
+/* post a receive into a fresh pool buffer on the socket of A or B */
+static void ringrecv(int AorB)
+{
+  struct pkt *packet = newpkt();
+  struct io_uring_sqe *sqe;
+
+  if (registered(packet)) {
+    sqe = uring_sqe(&ring, IORING_OP_READ_FIXED, ends[AorB].sock,
+                    (uintptr_t)packet | (CQ_RECV + AorB));
+    sqe->buf_index = 0;
+  }
+  else
+    sqe = uring_sqe(&ring, IORING_OP_RECV, ends[AorB].sock,
+                    (uintptr_t)packet | (CQ_RECV + AorB));
+  sqe->addr = (uintptr_t)packet;
+  sqe->len = sizeof(struct pkt);
+}
+
+/* post a read of the expiration count of the source timer */
+static void ringsource(void)
+{
+  struct io_uring_sqe *sqe;
+
+  sqe = uring_sqe(&ring, IORING_OP_READ, sourcefd, CQ_SOURCE);
+  sqe->addr = (uintptr_t)&ticks;
+  sqe->len = sizeof(ticks);
+}
+
+/********************** LAYER 5 ***********************/
+/* offer the next message to A; returns 0 if the sender turned it away */
+static int offer(void)
+{
+  struct msg m;
+  int64_t stamp = nsecs();
+  long before = window_full;
+
+  memset(m.data, 97 + nsim % 26, MSGSIZE);
+  memcpy(m.data, &stamp, sizeof(stamp));
+  memcpy(m.data + sizeof(stamp), &nsim, sizeof(nsim));
+  noffered++;
+  proto->A_output(&m);
+  if (window_full != before)
+    return 0;
+  nsim++;
+  return 1;
+}
+
+void deliver(int AorB, const struct pkt *packet, const char *datasent, int length)
+{
+  int64_t stamp;
+  double latency;
+
+  if (TRACE>2)
+    printf("          TOLAYER5: data received by application at %c\n", AorB == A ? 'A' : 'B');
+  messages_delivered++;
+  bytes_delivered += length;
+  if (length >= (int)sizeof(stamp)) {
+    memcpy(&stamp, datasent, sizeof(stamp));
+    latency = (nsecs() - stamp) / 1000.0;
+    latencysum += latency;
+    if (latency > latencymax)
+      latencymax = latency;
+  }
+}
+
+/********************** SETUP *************************/
+static void addfd(int fd, uint32_t tag)
+{
+  struct epoll_event ev;
+
+  ev.events = EPOLLIN;
+  ev.data.u32 = tag;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    fail("epoll_ctl");
+}
+
+static void openendpoints(void)
+{
+  struct sockaddr_in addr[2];
+  socklen_t len;
+  int AorB, i, bufsize = 4 << 20;
+  int nonblock = useuring ? 0 : SOCK_NONBLOCK;  /* io_uring waits by itself */
+
+  if (!useuring) {
+    epfd = epoll_create1(0);
+    if (epfd < 0)
+      fail("epoll_create1");
+  }
+  for (AorB=A; AorB<=B; AorB++) {
+    ends[AorB].sock = socket(AF_INET, SOCK_DGRAM | nonblock, 0);
+    if (ends[AorB].sock < 0)
+      fail("socket");
+    setsockopt(ends[AorB].sock, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+    setsockopt(ends[AorB].sock, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+    memset(&addr[AorB], 0, sizeof(addr[AorB]));
+    addr[AorB].sin_family = AF_INET;
+    addr[AorB].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr[AorB].sin_port = 0;
+    len = sizeof(addr[AorB]);
+    if (bind(ends[AorB].sock, (struct sockaddr *)&addr[AorB], len) < 0 ||
+        getsockname(ends[AorB].sock, (struct sockaddr *)&addr[AorB], &len) < 0)
+      fail("bind");
+    if (!useuring)
+      addfd(ends[AorB].sock, EVTAG(EV_SOCKET, AorB, 0));
+    for (i=RTTIMER; !useuring && i<=FLUSHTIMER; i++) {
+      ends[AorB].timerfd[i] = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+      if (ends[AorB].timerfd[i] < 0)
+        fail("timerfd_create");
+      addfd(ends[AorB].timerfd[i], EVTAG(EV_TIMER, AorB, i));
+    }
+  }
+  ends[A].peer = addr[B];
+  ends[B].peer = addr[A];
+  for (AorB=A; AorB<=B; AorB++)
+    if (connect(ends[AorB].sock, (struct sockaddr *)&ends[AorB].peer, sizeof(ends[AorB].peer)) < 0)
+      fail("connect");
+
+  sourcefd = -1;
+  if (lambda > 0.0) {
+    struct itimerspec its;
+    int64_t ns = (int64_t)(lambda * usecperunit * 1000.0);
+
+    if (ns == 0)
+      ns = 1;
+    sourcefd = timerfd_create(CLOCK_MONOTONIC, nonblock ? TFD_NONBLOCK : 0);
+    if (sourcefd < 0)
+      fail("timerfd_create");
+    its.it_value.tv_sec = its.it_interval.tv_sec = ns / 1000000000;
+    its.it_value.tv_nsec = its.it_interval.tv_nsec = ns % 1000000000;
+    if (timerfd_settime(sourcefd, 0, &its, NULL) < 0)
+      fail("timerfd_settime");
+    if (!useuring)
+      addfd(sourcefd, EVTAG(EV_SOURCE, A, 0));
+  }
+}
+
+/* set up io_uring and register the first pool buffers with it; */
+/* returns 0 if the kernel does not offer io_uring              */
+static int openring(void)
+{
+  struct iovec iov;
+
+  if (uring_init(&ring, 256) < 0)
+    return 0;
+  iov.iov_base = growpool(POOLSIZE, &regionlen);
+  iov.iov_len = regionlen;
+  if (uring_register(&ring, &iov, 1) < 0)
+    regionlen = 0;                /* plain sends and receives still work */
+  else
+    region = iov.iov_base;
+  return 1;
+}
+
+static void parseargs(int argc, char **argv)
+{
+  int i;
+
+  proto = engines[0];
+  TRACE = 0;
+  for (i=1; i<argc; i++) {
+    if (settingarg(argc, argv, &i))
+      continue;
+    else if (strcmp(argv[i], "-p") == 0 && i+1 < argc) {
+      if ((proto = findprotocol(argv[++i])) == NULL) {
+        printf("unknown protocol %s\n", argv[i]);
+        exit(EXIT_FAILURE);
+      }
+    }
+    else if (strcmp(argv[i], "-n") == 0 && i+1 < argc)
+      nsimmax = atol(argv[++i]);
+    else if (strcmp(argv[i], "-l") == 0 && i+1 < argc)
+      lambda = atof(argv[++i]);
+    else if (strcmp(argv[i], "-u") == 0 && i+1 < argc)
+      usecperunit = atof(argv[++i]);
+    else if (strcmp(argv[i], "-L") == 0 && i+1 < argc)
+      lossprob = atof(argv[++i]);
+    else if (strcmp(argv[i], "-C") == 0 && i+1 < argc)
+      corruptprob = atof(argv[++i]);
+    else if (strcmp(argv[i], "-D") == 0 && i+1 < argc)
+      corruptdirection = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-t") == 0 && i+1 < argc)
+      TRACE = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-U") == 0)
+      useuring = 1;
+    else {
+      printf("usage: %s [-p gbn|sr] [-n messages] [-l lambda] [-u usec per time unit]\n"
+             "          [-L loss] [-C corruption] [-D direction 0 A->B, 1 A<-B, 2 both]\n"
+             "          [-t trace] [-U] %s\n", argv[0], SETTINGSUSAGE);
+      exit(EXIT_FAILURE);
+    }
+  }
+  checksettings();
+  if (corruptdirection < 0 || corruptdirection > 2) {
+    printf("the direction of loss and corruption must be 0, 1 or 2\n");
+    exit(EXIT_FAILURE);
+  }
+  if (usecperunit <= 0.0 || lambda < 0.0) {
+    printf("time unit and lambda must be positive\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/********************** EVENT LOOP ********************/
+static void timerfired(int AorB, int which)
+{
+  ends[AorB].armed[which] = 0;
+  if (which == RTTIMER)
+    AorB == A ? proto->A_timerinterrupt() : proto->B_timerinterrupt();
+  else
+    AorB == A ? proto->A_flushinterrupt() : proto->B_flushinterrupt();
+}
+
+/* the periodic source offers -n messages, dropping those that find the */
+/* window full as the emulator does; the saturating one retries until  */
+/* -n have been accepted                                               */
+static int sourcedone(void)
+{
+  return (sourcefd < 0 ? nsim : noffered) >= nsimmax;
+}
+
+static void sourcefired(uint64_t expirations)
+{
+  while (expirations-- > 0 && !sourcedone())
+    offer();
+}
+
+/* a saturating source keeps offering until the sender pushes back */
+static void saturate(void)
+{
+  if (sourcefd < 0 && !sourcedone()) {
+    while (!sourcedone() && offer())
+      ;
+    if (!sourcedone())
+      nrefused++;
+  }
+}
+
+/* done once every message is in and A has nothing left outstanding */
+static int finished(void)
+{
+  return sourcedone() && !ends[A].armed[RTTIMER] && !ends[A].armed[FLUSHTIMER];
+}
+
+static void epollloop(void)
+{
+  struct epoll_event evs[16];
+  uint64_t expirations;
+  int i, n, kind, AorB, which;
+
+  for (;;) {
+    saturate();
+    for (AorB=A; AorB<=B; AorB++)
+      if (ends[AorB].nout > 0)
+        flushout(&ends[AorB]);
+    if (finished())
+      break;
+
+    n = epoll_wait(epfd, evs, 16, -1);
+    nsyscalls++;
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      fail("epoll_wait");
+    }
+    for (i=0; i<n; i++) {
+      kind = evs[i].data.u32 >> 16;
+      which = (evs[i].data.u32 >> 8) & 0xff;
+      AorB = evs[i].data.u32 & 0xff;
+      if (kind == EV_SOCKET)
+        receive(AorB);
+      else if (kind == EV_TIMER) {
+        nsyscalls++;
+        if (read(ends[AorB].timerfd[which], &expirations, sizeof(expirations)) != sizeof(expirations)
+            || !ends[AorB].armed[which])
+          continue;               /* stopped or restarted since it fired */
+        timerfired(AorB, which);
+      }
+      else if (kind == EV_SOURCE) {
+        nsyscalls++;
+        if (read(sourcefd, &expirations, sizeof(expirations)) == sizeof(expirations))
+          sourcefired(expirations);
+      }
+    }
+  }
+}
+
+/* handle one io_uring completion */
+static void completed(uint64_t data, int res)
+{
+  struct pkt *packet = (struct pkt *)(uintptr_t)(data & ~(uint64_t)CQ_KIND);
+  int kind = data & CQ_KIND, no, AorB;
+
+  if (kind == CQ_SEND) {
+    if (res < 0)
+      nlost++;                    /* socket buffer full: the packet is lost */
+    releasepkt(packet);
+  }
+  else if (kind == CQ_RECV + A || kind == CQ_RECV + B) {
+    AorB = kind - CQ_RECV;
+    nrecvpkts++;
+    if (res >= HDRSIZE && res - HDRSIZE == packet->length)
+      AorB == A ? proto->A_input(packet) : proto->B_input(packet);
+    releasepkt(packet);           /* the entity holds its own reference */
+    if (res < 0 && res != -EINTR && res != -EAGAIN) {
+      errno = -res;
+      fail("io_uring receive");
+    }
+    ringrecv(AorB);
+  }
+  else if (kind == CQ_TIMER) {
+    no = (data >> 3) & 3;
+    AorB = no / 2;
+    if (res != -ETIME || data != timertag(no) || !ends[AorB].armed[no % 2])
+      return;                     /* removed, or stopped or restarted since */
+    timerfired(AorB, no % 2);
+  }
+  else if (kind == CQ_SOURCE) {
+    if (res == sizeof(ticks))
+      sourcefired(ticks);
+    ringsource();
+  }
+}
+
+static void uringloop(void)
+{
+  uint64_t data;
+  int i, res, AorB;
+
+  for (AorB=A; AorB<=B; AorB++)
+    for (i=0; i<NRECV; i++)
+      ringrecv(AorB);
+  if (sourcefd >= 0)
+    ringsource();
+
+  for (;;) {
+    saturate();
+    if (finished())
+      break;
+    /* one call submits everything queued and waits for the next completion */
+    if (uring_submit(&ring, 1) < 0)
+      fail("io_uring_enter");
+    while (uring_peek(&ring, &data, &res))
+      completed(data, res);
+  }
+  nsyscalls += ring.nenter;
+}
+
+int main(int argc, char **argv)
+{
+  int64_t start, elapsed;
+
+  parseargs(argc, argv);
+  outfile = stdout;
+  if (useuring) {
+    useuring = openring();
+    if (useuring) {
+      FILE *out = uring_fdopen(STDOUT_FILENO, &nwrites);
+
+      fflush(stdout);
+      if (out != NULL)
+        outfile = out;
+    }
+    else
+      printf("io_uring is not available, using epoll\n");
+  }
+  srand(9999);
+  openendpoints();
+  proto->A_init();
+  proto->B_init();
+
+  start = nsecs();
+  if (useuring)
+    uringloop();
+  else
+    epollloop();
+  elapsed = nsecs() - start;
+
+  fflush(stdout);
+  fprintf(outfile, " Protocol: %s over UDP loopback (%s)\n", proto->name, useuring ? "io_uring" : "epoll");
+  fprintf(outfile, "number of messages offered by layer5:  %ld \n", noffered);
+  fprintf(outfile, "number of messages accepted by the sender:  %ld \n", nsim);
+  if (sourcefd < 0)
+    fprintf(outfile, "number of times the saturating source was held back by a full window:  %ld \n", nrefused);
+  else
+    fprintf(outfile, "number of messages dropped due to full window:  %ld \n", window_full);
+  fprintf(outfile, "number of packet resends by A:  %ld \n", packets_resent);
+  fprintf(outfile, "number of packets sent into layer 3:  %ld (lost %ld, corrupted %ld by the shim)\n",
+          ntolayer3, nlost, ncorrupt);
+  if (fecgroup > 0)
+    fprintf(outfile, "number of packets recovered by FEC at B:  %ld \n", packets_recovered);
+  if (recvbuffer > 0 && strcmp(proto->name, "sr") == 0)
+    fprintf(outfile, "receive buffer:  at most %ld of %ld bytes held, %ld packets dropped for want of room\n",
+            recv_peak, recvbuffer, recv_dropped);
+  fprintf(outfile, "number of messages delivered to application:  %ld \n", messages_delivered);
+  fprintf(outfile, "wall clock time:  %f s\n", elapsed / 1e9);
+  fprintf(outfile, "messages delivered per second:  %f \n", messages_delivered / (elapsed / 1e9));
+  if (messages_delivered > 0)
+    fprintf(outfile, "message latency:  mean %f us, max %f us\n",
+            latencysum / messages_delivered, latencymax);
+  if (useuring)
+    fprintf(outfile, "io_uring_enter calls:  %ld (%f packets received per call)\n",
+            ring.nenter, ring.nenter ? (double)nrecvpkts / ring.nenter : 0.0);
+  else
+    fprintf(outfile, "sendmmsg calls:  %ld, recvmmsg calls:  %ld (%f packets per call)\n",
+            nsendcalls, nrecvcalls, nrecvcalls ? (double)nrecvpkts / nrecvcalls : 0.0);
+  fprintf(outfile, "timer updates:  %ld for %ld starts and stops\n", ntimersets, ntimercalls);
+  if (!useuring)
+    fprintf(outfile, "system calls in the event loop:  %ld (%f per delivered message)\n",
+            nsyscalls, messages_delivered ? (double)nsyscalls / messages_delivered : 0.0);
+  else {
+    /* the stream's count is final only once closing it has written out the report */
+    fprintf(outfile, "system calls in the event loop:  %ld \n", nsyscalls);
+    if (outfile != stdout)
+      fclose(outfile);
+    printf("output stream writes:  %ld, system calls with them:  %ld (%f per delivered message)\n",
+           nwrites, nsyscalls + nwrites,
+           messages_delivered ? (double)(nsyscalls + nwrites) / messages_delivered : 0.0);
+  }
+  fclose(stdout);
+  return EXIT_SUCCESS;
+}
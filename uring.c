@@ -0,0 +1,301 @@
+/* ******************************************************************
+   Minimal io_uring access through the raw system calls, and a stdio
+   stream that writes through a ring of its own.  See uring.h.
+   ****************************************************************** */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+
+/********************** RING **************************/
+int uring_init(struct uring *r, unsigned entries)
+{
+  struct io_uring_params p;
+  char *sq, *cq;
+  size_t sqlen, cqlen;
+
+  memset(r, 0, sizeof(*r));
+  memset(&p, 0, sizeof(p));
+  r->fd = syscall(__NR_io_uring_setup, entries, &p);
+  if (r->fd < 0)
+    return -1;
+  sqlen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cqlen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (cqlen > sqlen)
+      sqlen = cqlen;
+    cqlen = sqlen;
+  }
+  sq = mmap(NULL, sqlen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            r->fd, IORING_OFF_SQ_RING);
+  if (sq == MAP_FAILED) {
+    close(r->fd);
+    return -1;
+  }
+  cq = sq;
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+    cq = mmap(NULL, cqlen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+              r->fd, IORING_OFF_CQ_RING);
+    if (cq == MAP_FAILED) {
+      munmap(sq, sqlen);
+      close(r->fd);
+      return -1;
+    }
+  }
+  r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+  if (r->sqes == MAP_FAILED) {
+    if (cq != sq)
+      munmap(cq, cqlen);
+    munmap(sq, sqlen);
+    close(r->fd);
+    return -1;
+  }
+  r->sqmap = sq;
+  r->sqmaplen = sqlen;
+  r->cqmap = cq;
+  r->cqmaplen = cqlen;
+  r->features = p.features;
+  r->entries = p.sq_entries;
+  r->sqhead = (unsigned *)(sq + p.sq_off.head);
+  r->sqtail = (unsigned *)(sq + p.sq_off.tail);
+  r->sqmask = (unsigned *)(sq + p.sq_off.ring_mask);
+  r->sqarray = (unsigned *)(sq + p.sq_off.array);
+  r->cqhead = (unsigned *)(cq + p.cq_off.head);
+  r->cqtail = (unsigned *)(cq + p.cq_off.tail);
+  r->cqmask = (unsigned *)(cq + p.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+  r->sqlocal = *r->sqtail;
+  return 0;
+}
+
+void uring_exit(struct uring *r)
+{
+  munmap(r->sqes, r->entries * sizeof(struct io_uring_sqe));
+  if (r->cqmap != r->sqmap)
+    munmap(r->cqmap, r->cqmaplen);
+  munmap(r->sqmap, r->sqmaplen);
+  close(r->fd);
+}
+
+int uring_register(struct uring *r, const struct iovec *iov, unsigned n)
+{
+  return syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_BUFFERS, iov, n);
+}
+
+struct io_uring_sqe *uring_sqe(struct uring *r, int opcode, int fd, uint64_t data)
+{
+  struct io_uring_sqe *sqe;
+  unsigned idx;
+
+  while (r->sqlocal - __atomic_load_n(r->sqhead, __ATOMIC_ACQUIRE) >= r->entries)
+    uring_submit(r, 0);
+  idx = r->sqlocal & *r->sqmask;
+  r->sqarray[idx] = idx;
+  sqe = &r->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->user_data = data;
+  r->sqlocal++;
+  return sqe;
+}
+
+int uring_submit(struct uring *r, unsigned waitfor)
+{
+  unsigned pending;
+  int n;
+
+  __atomic_store_n(r->sqtail, r->sqlocal, __ATOMIC_RELEASE);
+  for (;;) {
+    pending = r->sqlocal - __atomic_load_n(r->sqhead, __ATOMIC_ACQUIRE);
+    n = syscall(__NR_io_uring_enter, r->fd, pending, waitfor,
+                waitfor > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    r->nenter++;
+    if (n >= 0 || errno != EINTR)
+      return n;
+  }
+}
+
+int uring_peek(struct uring *r, uint64_t *data, int *res)
+{
+  unsigned head = *r->cqhead;
+  struct io_uring_cqe *cqe;
+
+  if (head == __atomic_load_n(r->cqtail, __ATOMIC_ACQUIRE))
+    return 0;
+  cqe = &r->cqes[head & *r->cqmask];
+  *data = cqe->user_data;
+  *res = cqe->res;
+  __atomic_store_n(r->cqhead, head + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+/********************** OUTPUT STREAM *****************/
+/* two registered blocks: one is filled by stdio while the other is being */
+/* written, and a block is only submitted once the previous write is      */
+/* complete, so the data reaches fd in order at its current position      */
+#define  STREAMBLOCK  (64 * 1024)
+
+struct ustream {
+  struct uring ring;
+  int usering;
+  int fd;
+  char *buf[2];
+  size_t len[2];
+  int cur;
+  int busy;                 /* the other block is being written */
+  int error;
+  long *nwrites;
+};
+
+static void writeall(struct ustream *s, const char *data, size_t len)
+{
+  ssize_t n;
+
+  while (len > 0) {
+    n = write(s->fd, data, len);
+    if (s->nwrites != NULL)
+      (*s->nwrites)++;
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      s->error = 1;
+      return;
+    }
+    data += n;
+    len -= n;
+  }
+}
+
+/* wait for the block in flight and finish it off if the write was short */
+static void waitblock(struct ustream *s)
+{
+  uint64_t data;
+  int res, other = !s->cur;
+
+  if (!s->busy)
+    return;
+  while (!uring_peek(&s->ring, &data, &res)) {
+    if (s->nwrites != NULL)
+      (*s->nwrites)++;
+    if (uring_submit(&s->ring, 1) < 0) {
+      s->error = 1;
+      s->busy = 0;
+      return;
+    }
+  }
+  if (res < 0)
+    s->error = 1;
+  else if ((size_t)res < s->len[other])
+    writeall(s, s->buf[other] + res, s->len[other] - res);
+  s->len[other] = 0;
+  s->busy = 0;
+}
+
+static void putblock(struct ustream *s)
+{
+  struct io_uring_sqe *sqe;
+
+  if (s->len[s->cur] == 0)
+    return;
+  if (!s->usering) {
+    writeall(s, s->buf[s->cur], s->len[s->cur]);
+    s->len[s->cur] = 0;
+    return;
+  }
+  waitblock(s);
+  sqe = uring_sqe(&s->ring, IORING_OP_WRITE_FIXED, s->fd, s->cur);
+  sqe->addr = (uint64_t)(uintptr_t)s->buf[s->cur];
+  sqe->len = s->len[s->cur];
+  sqe->off = (uint64_t)-1;      /* at the file position, and advance it */
+  sqe->buf_index = s->cur;
+  if (s->nwrites != NULL)
+    (*s->nwrites)++;
+  if (uring_submit(&s->ring, 0) < 0) {
+    s->error = 1;
+    return;
+  }
+  s->busy = 1;
+  s->cur = !s->cur;
+}
+
+static ssize_t streamwrite(void *cookie, const char *data, size_t size)
+{
+  struct ustream *s = cookie;
+  size_t n, done = 0;
+
+  while (done < size) {
+    n = STREAMBLOCK - s->len[s->cur];
+    if (n > size - done)
+      n = size - done;
+    memcpy(s->buf[s->cur] + s->len[s->cur], data + done, n);
+    s->len[s->cur] += n;
+    done += n;
+    if (s->len[s->cur] == STREAMBLOCK)
+      putblock(s);
+  }
+  return s->error ? -1 : (ssize_t)size;
+}
+
+static int streamclose(void *cookie)
+{
+  struct ustream *s = cookie;
+  int error;
+
+  putblock(s);
+  if (s->usering) {
+    waitblock(s);
+    uring_exit(&s->ring);
+  }
+  error = s->error;
+  free(s->buf[0]);
+  free(s);
+  return error ? EOF : 0;
+}
+
+FILE *uring_fdopen(int fd, long *nwrites)
+{
+  cookie_io_functions_t io;
+  struct ustream *s;
+  struct iovec iov[2];
+  FILE *f;
+
+  s = calloc(1, sizeof(*s));
+  if (s == NULL)
+    return NULL;
+  s->buf[0] = malloc(2 * STREAMBLOCK);
+  if (s->buf[0] == NULL) {
+    free(s);
+    return NULL;
+  }
+  s->buf[1] = s->buf[0] + STREAMBLOCK;
+  s->fd = fd;
+  s->nwrites = nwrites;
+  if (uring_init(&s->ring, 4) == 0) {
+    iov[0].iov_base = s->buf[0];
+    iov[1].iov_base = s->buf[1];
+    iov[0].iov_len = iov[1].iov_len = STREAMBLOCK;
+    /* writes at the current position need IORING_FEAT_RW_CUR_POS */
+    if ((s->ring.features & IORING_FEAT_RW_CUR_POS) && uring_register(&s->ring, iov, 2) == 0)
+      s->usering = 1;
+    else
+      uring_exit(&s->ring);
+  }
+  memset(&io, 0, sizeof(io));
+  io.write = streamwrite;
+  io.close = streamclose;
+  f = fopencookie(s, "w", io);
+  if (f == NULL) {
+    if (s->usering)
+      uring_exit(&s->ring);
+    free(s->buf[0]);
+    free(s);
+  }
+  return f;
+}
@@ -0,0 +1,45 @@
+/* ******************************************************************
+   Minimal io_uring access for the UDP backend, made through the raw
+   system calls (liburing is not required).  One submission/completion
+   ring pair; requests are queued with uring_sqe(), handed to the kernel
+   by uring_submit() and their completions read back with uring_peek().
+   ****************************************************************** */
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+struct uring {
+  int fd;
+  unsigned *sqhead, *sqtail, *sqmask, *sqarray;
+  struct io_uring_sqe *sqes;
+  unsigned *cqhead, *cqtail, *cqmask;
+  struct io_uring_cqe *cqes;
+  void *sqmap, *cqmap;      /* the mapped rings, for uring_exit() */
+  size_t sqmaplen, cqmaplen;
+  unsigned features;        /* IORING_FEAT_* reported by the kernel */
+  unsigned entries;
+  unsigned sqlocal;         /* tail including the entries not yet published */
+  long nenter;              /* io_uring_enter calls made */
+};
+
+/* set up a ring with room for entries requests; returns -1 if io_uring */
+/* is not available, and the caller should fall back to other calls     */
+extern int uring_init(struct uring *, unsigned entries);
+extern void uring_exit(struct uring *);
+/* register n buffers for IORING_OP_READ_FIXED / WRITE_FIXED */
+extern int uring_register(struct uring *, const struct iovec *, unsigned n);
+/* next free submission entry, cleared, with opcode, fd and user data set; */
+/* submits what is queued first if the ring is full                       */
+extern struct io_uring_sqe *uring_sqe(struct uring *, int opcode, int fd, uint64_t data);
+/* submit the queued entries and wait for at least waitfor completions */
+extern int uring_submit(struct uring *, unsigned waitfor);
+/* take one completion off the ring; returns 0 if there is none */
+extern int uring_peek(struct uring *, uint64_t *data, int *res);
+
+/* a write-only stream on fd whose data goes out in large blocks from */
+/* registered buffers through a ring of its own, with plain write()   */
+/* calls if io_uring is not available.  nwrites, if not NULL, counts   */
+/* the system calls the stream makes.                                 */
+extern FILE *uring_fdopen(int fd, long *nwrites);